@@ -4,8 +4,16 @@ author: Linductor
 data: 2025/05/03
 */
 #include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <gio/gio.h>
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <atomic>
@@ -14,20 +22,71 @@ data: 2025/05/03
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <json/json.h>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sys/stat.h>
+#include <sstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include "common.h"
+#include "latency_budget.h"
+#include "shm_ring.h"
+#include "frame_trace.h"
 
 // 全局配置
 const int DISCOVERY_PORT = 37020;
 const int HEARTBEAT_PORT = 5001;
-const int VIDEO_PORT = 5000;
-std::atomic<bool> is_connected{false};
+const int TILE_WIDTH = 640;    // 单路画面显示尺寸
+const int TILE_HEIGHT = 360;
 std::atomic<bool> exit_program{false};
-std::atomic<int> receiver_status{200}; // 200=正常，300=拥塞
 std::vector<Json::Value> servers;
 std::mutex servers_mutex;
-Json::Value last_server_info;
-int last_cam_index = -1;
-std::atomic<bool> abnormal_disconnect{false};
-int heartbeat_socket = -1;
+std::atomic<int> next_stream_id{0};
+pthread_t main_thread;
+
+// 信号处理：置退出标志，并转发给主线程打断阻塞在终端输入上的getline，
+// 之后由主线程按正常流程退出（含写出帧追踪）
+void signal_handler(int signum) {
+    exit_program = true;
+    if (!pthread_equal(pthread_self(), main_thread)) pthread_kill(main_thread, signum);
+}
+
+// 视频显示方式：每路独立窗口 / 拼接为一个窗口 / 无界面交给帧回调
+enum class ViewMode { Window, Mosaic, Headless };
+ViewMode view_mode = ViewMode::Window;
+
+// 一路视频流：服务端的一个摄像头，接收端口由客户端临时分配
+struct VideoStream {
+    int id = 0;
+    int camera_index = -1;
+    int video_port = 0;
+    int udp_socket = -1;            // 已绑定的UDP socket，交给udpsrc使用
+    std::string shm_name;           // 非空表示服务端同意经共享内存传输原始帧
+    std::atomic<uint64_t> frames{0};
+    std::atomic<int> status{200};                 // 200=正常，300=拥塞，由本路的QoS消息更新
+    std::atomic<bool> keyframe_requested{false};  // 解码前丢了压缩数据，随下次心跳请求关键帧
+    std::thread thread;
+};
+
+// 与一个服务端的控制连接，可同时承载多路视频流
+struct ServerConnection {
+    Json::Value server_info;
+    // 控制连接：建立与选择阶段归调用方（主线程或重连时的监督线程），
+    // 推流期间归心跳线程；只有当前持有者关闭，其他线程只设置stop_requested/exit_program
+    std::atomic<int> heartbeat_socket{-1};
+    std::string codec = "H264";            // 在选择消息中告知服务端的编码格式
+    bool local_transport = false;          // 服务端与客户端同机且支持共享内存传输
+    std::vector<int> camera_indices;       // 断线重连时自动重新选择
+    std::vector<std::unique_ptr<VideoStream>> streams;
+    std::atomic<bool> connected{false};
+    std::atomic<bool> abnormal_disconnect{false};
+    std::atomic<bool> stop_requested{false};
+    std::atomic<bool> finished{false};
+    std::thread supervisor;
+};
 
 // ================== 服务发现模块 ==================
 void discover_servers() {
@@ -78,145 +137,1134 @@ void discover_servers() {
     close(sock);
 }
 
+
 // ================== 心跳维护模块 ==================
-void handle_heartbeat() {
+const int HEARTBEAT_TIMEOUT_S = 5;  // 服务端每秒左右发送一次PING，超过该时长视为异常断开
+
+void handle_heartbeat(ServerConnection* conn) {
+    const int sock = conn->heartbeat_socket;
     char buffer[16];
-    while (is_connected && !exit_program) {
-        int bytes_received = recv(heartbeat_socket, buffer, sizeof(buffer), 0);
-        
+    // 短超时轮询，以便及时响应断开与退出请求
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 500000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    auto last_ping = std::chrono::steady_clock::now();
+
+    while (conn->connected) {
+        if (conn->stop_requested || exit_program) {
+            conn->abnormal_disconnect = false;
+            std::cout << "[心跳] 连接正常关闭" << std::endl;
+            break;
+        }
+        int bytes_received = recv(sock, buffer, sizeof(buffer), 0);
+        if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            if (std::chrono::steady_clock::now() - last_ping > std::chrono::seconds(HEARTBEAT_TIMEOUT_S)) {
+                std::cerr << "[心跳] 服务端超过 " << HEARTBEAT_TIMEOUT_S << " 秒无心跳" << std::endl;
+                conn->abnormal_disconnect = true;
+                break;
+            }
+            continue;
+        }
+
         // 检测连接断开
         if (bytes_received <= 0) {
             if (bytes_received == 0) {
-                abnormal_disconnect = false;
+                conn->abnormal_disconnect = false;
                 std::cout << "[心跳] 连接正常关闭" << std::endl;
             } else {
-                abnormal_disconnect = true;
+                conn->abnormal_disconnect = true;
                 perror("[心跳] 接收错误");
             }
-            is_connected = false;
             break;
         }
-        
-        // 正常处理心跳
-        std::string status = std::to_string(receiver_status.load());
-        if (send(heartbeat_socket, status.c_str(), status.size(), 0) <= 0) {
+        last_ping = std::chrono::steady_clock::now();
+
+        // 正常处理心跳：汇总状态码（任一路拥塞即为拥塞）后附上各路状态码与
+        // 需要关键帧的摄像头，以换行结束一条应答
+        int aggregate = 200;
+        std::string detail;
+        for (auto& stream : conn->streams) {
+            int code = stream->status.load();
+            aggregate = std::max(aggregate, code);
+            detail += " " + std::to_string(stream->camera_index) + ":" + std::to_string(code);
+        }
+        for (auto& stream : conn->streams) {
+            if (stream->keyframe_requested.exchange(false)) {
+                detail += " k" + std::to_string(stream->camera_index);
+            }
+        }
+        std::string status = std::to_string(aggregate) + detail + "\n";
+        if (send(sock, status.c_str(), status.size(), MSG_NOSIGNAL) <= 0) {
             perror("[心跳] 发送状态失败");
-            is_connected = false;
+            conn->abnormal_disconnect = !conn->stop_requested;
             break;
         }
         std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
-    
-    // 清理资源
-    if (heartbeat_socket != -1) {
-        close(heartbeat_socket);
-        heartbeat_socket = -1;
+
+    // 清理资源：心跳线程是推流期间控制连接的唯一持有者
+    conn->connected = false;
+    conn->heartbeat_socket = -1;
+    shutdown(sock, SHUT_RDWR);
+    close(sock);
+}
+
+// ================== 缩略图预览模块 ==================
+// 选择摄像头前向服务端请求缩略图，无需打开视频流即可预览各摄像头画面。
+// JPEG只保存在内存中，经appsrc交给jpegdec解码，不在共享的临时目录落盘
+typedef std::map<int, std::vector<guint8>> ThumbnailMap;
+
+ThumbnailMap fetch_thumbnails(ServerConnection* conn) {
+    ThumbnailMap thumbnails;
+    Json::Value request, reply;
+    request["type"] = "get_thumbnails";
+    if (!send_json(conn->heartbeat_socket, request) ||
+        !recv_json_line(conn->heartbeat_socket, reply) ||
+        !reply.isObject() || !reply["thumbnails"].isArray()) {
+        return thumbnails;
     }
+
+    for (const auto& entry : reply["thumbnails"]) {
+        if (!entry.isObject() || !entry["camera_index"].isInt() || !entry["jpeg"].isString()) continue;
+        gsize size = 0;
+        guchar* jpeg = g_base64_decode(entry["jpeg"].asCString(), &size);
+        if (size > 0) thumbnails[entry["camera_index"].asInt()].assign(jpeg, jpeg + size);
+        g_free(jpeg);
+    }
+    return thumbnails;
+}
+
+// 把缩略图按网格拼接到一个预览窗口，返回的管道在选择完成后停止
+GstElement* show_thumbnail_preview(const Json::Value& cameras, const ThumbnailMap& thumbnails) {
+    if (thumbnails.empty() || view_mode == ViewMode::Headless) return nullptr;
+    const int width = 320, height = 180;
+    int cols = (int)std::ceil(std::sqrt((double)thumbnails.size()));
+    std::ostringstream desc;
+    desc << "compositor name=preview background=black";
+    int tile = 0;
+    for (Json::Value::ArrayIndex i = 0; i < cameras.size(); ++i) {
+        if (!thumbnails.count(cameras[i].asInt())) continue;
+        desc << " sink_" << tile << "::xpos=" << (tile % cols) * width
+             << " sink_" << tile << "::ypos=" << (tile / cols) * height;
+        ++tile;
+    }
+    desc << " ! videoconvert ! autovideosink sync=false";
+    std::vector<const std::vector<guint8>*> tiles;
+    for (Json::Value::ArrayIndex i = 0; i < cameras.size(); ++i) {
+        auto it = thumbnails.find(cameras[i].asInt());
+        if (it == thumbnails.end()) continue;
+        desc << " appsrc name=thumb" << tiles.size() << " caps=image/jpeg ! jpegdec ! imagefreeze ! "
+             << "videoconvert ! videoscale ! video/x-raw,width=" << width << ",height=" << height
+             << " ! textoverlay text=\"[" << i << "]\" valignment=top halignment=left"
+             << " ! preview.sink_" << tiles.size();
+        tiles.push_back(&it->second);
+    }
+
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(desc.str().c_str(), &error);
+    if (error) {
+        std::cerr << "缩略图预览创建失败: " << error->message << std::endl;
+        g_error_free(error);
+    }
+    if (!pipeline) return nullptr;
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // 每路只推一帧JPEG，imagefreeze持续输出该画面
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        GstElement* source = gst_bin_get_by_name(GST_BIN(pipeline), ("thumb" + std::to_string(t)).c_str());
+        if (!source) continue;
+        GstBuffer* buffer = gst_buffer_new_allocate(nullptr, tiles[t]->size(), nullptr);
+        gst_buffer_fill(buffer, 0, tiles[t]->data(), tiles[t]->size());
+        gst_app_src_push_buffer(GST_APP_SRC(source), buffer);  // 转移所有权
+        gst_app_src_end_of_stream(GST_APP_SRC(source));
+        gst_object_unref(source);
+    }
+    return pipeline;
+}
+
+void stop_thumbnail_preview(GstElement* pipeline) {
+    if (!pipeline) return;
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
 }
 
 // ================== 摄像头选择处理 ==================
-int select_camera(int sock, int auto_cam_index = -1) {
-    char buffer[1024];
-    int n = recv(sock, buffer, sizeof(buffer), 0);
-    if (n <= 0) return -1;
+// 支持的编码格式及对应的解包/解码元素
+struct DecoderElements {
+    const char* codec;
+    const char* depay;
+    const char* decoder;
+};
+const DecoderElements DECODERS[] = {
+    {"H264", "rtph264depay", "avdec_h264"},
+    {"H265", "rtph265depay", "avdec_h265"},
+    {"VP8", "rtpvp8depay", "vp8dec"},
+};
 
+const DecoderElements* find_decoder(const std::string& codec) {
+    for (const auto& decoder : DECODERS) {
+        if (codec == decoder.codec) return &decoder;
+    }
+    return nullptr;
+}
+
+bool decoder_available(const std::string& codec) {
+    const DecoderElements* elements = find_decoder(codec);
+    if (!elements) return false;
+    GstElementFactory* depay = gst_element_factory_find(elements->depay);
+    GstElementFactory* decoder = gst_element_factory_find(elements->decoder);
+    bool ok = depay && decoder;
+    if (depay) gst_object_unref(depay);
+    if (decoder) gst_object_unref(decoder);
+    return ok;
+}
+
+// 服务端按码率效率给出可选格式，取第一个本机能解码的；旧服务端只给出codec
+std::string choose_codec(const Json::Value& cam_list) {
+    for (const auto& codec : cam_list["codecs"]) {
+        if (decoder_available(codec.asString())) return codec.asString();
+    }
+    return cam_list.get("codec", "H264").asString();
+}
+
+// 接收摄像头列表并选择摄像头；auto_cams非空时自动选择其中仍然可用的摄像头
+std::vector<int> select_cameras(ServerConnection* conn, const std::vector<int>& auto_cams = {}) {
+    std::vector<int> selected;
     Json::Value cam_list;
-    if (!Json::Reader().parse(buffer, buffer + n, cam_list)) return -1;
+    if (!recv_json_line(conn->heartbeat_socket, cam_list)) return selected;
+    conn->codec = choose_codec(cam_list);
+    conn->local_transport = false;
+    for (const auto& transport : cam_list["transports"]) {
+        if (transport.asString() == "shm" && cam_list["host_id"].asString() == host_boot_id()) {
+            conn->local_transport = true;
+        }
+    }
+    const Json::Value& cameras = cam_list["cameras"];
 
-    if (auto_cam_index != -1) {
+    if (!auto_cams.empty()) {
         // 自动选择之前的摄像头
-        for (Json::Value::ArrayIndex i = 0; i < cam_list["cameras"].size(); ++i) {
-            if (cam_list["cameras"][i].asInt() == auto_cam_index) {
-                Json::Value response;
-                response["camera_index"] = auto_cam_index;
-                std::string json_str = Json::FastWriter().write(response);
-                send(sock, json_str.c_str(), json_str.size(), 0);
-                return auto_cam_index;
+        for (int cam : auto_cams) {
+            for (Json::Value::ArrayIndex i = 0; i < cameras.size(); ++i) {
+                if (cameras[i].asInt() == cam) selected.push_back(cam);
             }
         }
-        return -1; // 摄像头不存在
+        return selected; // 为空表示摄像头均已不存在
     }
     
+    ThumbnailMap thumbnails;
+    if (cam_list.get("thumbnails", false).asBool()) thumbnails = fetch_thumbnails(conn);
+
     std::cout << "\n===== 可用摄像头列表 =====" << std::endl;
-    for (Json::Value::ArrayIndex i = 0; i < cam_list["cameras"].size(); ++i) {
+    for (Json::Value::ArrayIndex i = 0; i < cameras.size(); ++i) {
         std::cout << "[" << i << "] 摄像头索引 " 
-                << cam_list["cameras"][i].asInt() << std::endl;
+                << cameras[i].asInt();
+        auto it = thumbnails.find(cameras[i].asInt());
+        if (it != thumbnails.end()) std::cout << "  (有缩略图 " << it->second.size() / 1024.0 << "KB)";
+        std::cout << std::endl;
     }
+    GstElement* preview = show_thumbnail_preview(cameras, thumbnails);
 
-    int selected = -1;
     while (true) {
-        std::cout << "请选择摄像头序号 (q退出): ";
+        std::cout << "请选择摄像头序号，多路用逗号分隔 (a全部/q退出): ";
         std::string input;
         std::getline(std::cin, input);
         
-        if (input == "q") break;
+        if (input == "q" || !std::cin || exit_program) break;
+        if (input == "a") {
+            for (Json::Value::ArrayIndex i = 0; i < cameras.size(); ++i) {
+                selected.push_back(cameras[i].asInt());
+            }
+            break;
+        }
         
         try {
-            selected = std::stoi(input);
-            if (selected >= 0 && selected < cam_list["cameras"].size()) {
-                break;
+            std::stringstream ss(input);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                int index = std::stoi(item);
+                if (index < 0 || index >= (int)cameras.size()) throw std::out_of_range(item);
+                selected.push_back(cameras[index].asInt());
             }
-            std::cerr << "无效序号!" << std::endl;
+            if (!selected.empty()) break;
         } catch (...) {
-            std::cerr << "输入错误!" << std::endl;
+            selected.clear();
         }
+        std::cerr << "无效序号!" << std::endl;
     }
+    stop_thumbnail_preview(preview);
+    return selected;
+}
 
-    if (selected != -1) {
-        Json::Value response;
-        response["camera_index"] = cam_list["cameras"][selected].asInt();
-        std::string json_str = Json::FastWriter().write(response);
-        send(sock, json_str.c_str(), json_str.size(), 0);
+// 绑定一个临时UDP端口，返回socket与端口号
+int allocate_video_socket(int& port) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(0);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    socklen_t len = sizeof(addr);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        getsockname(sock, (struct sockaddr*)&addr, &len) < 0) {
+        close(sock);
+        return -1;
     }
-    return selected;
+    int rcvbuf = 4 << 20;  // 容纳关键帧突发
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    port = ntohs(addr.sin_port);
+    return sock;
 }
 
+// 为每路摄像头分配接收端口，并在选择消息中告知服务端
+bool send_camera_selection(ServerConnection* conn, const std::vector<int>& cameras) {
+    const char* transport = getenv("VS_LOCAL_TRANSPORT");
+    bool request_shm = conn->local_transport && transport && strcmp(transport, "shm") == 0;
+    Json::Value response;
+    for (int cam : cameras) {
+        std::unique_ptr<VideoStream> stream(new VideoStream);
+        stream->id = next_stream_id++;
+        stream->camera_index = cam;
+        stream->udp_socket = allocate_video_socket(stream->video_port);
+        if (stream->udp_socket < 0) {
+            perror("分配视频端口失败");
+            continue;
+        }
+        Json::Value entry;
+        entry["camera_index"] = cam;
+        entry["video_port"] = stream->video_port;
+        if (request_shm) entry["transport"] = "shm";
+        response["streams"].append(entry);
+        conn->streams.push_back(std::move(stream));
+    }
+    if (conn->streams.empty()) return false;
+    response["codec"] = conn->codec;
+    // 兼容只读取单路字段的服务端
+    response["camera_index"] = conn->streams[0]->camera_index;
+    response["video_port"] = conn->streams[0]->video_port;
+    if (!send_json(conn->heartbeat_socket, response)) return false;
+    if (!request_shm) return true;
+
+    // 服务端逐路回复实际采用的传输方式，仍为rtp的继续使用已分配的端口
+    Json::Value setup;
+    if (!recv_json_line(conn->heartbeat_socket, setup)) return false;
+    for (const auto& entry : setup["streams"]) {
+        if (entry["transport"].asString() != "shm") continue;
+        for (auto& stream : conn->streams) {
+            if (stream->camera_index != entry["camera_index"].asInt() || !stream->shm_name.empty()) continue;
+            stream->shm_name = entry["shm_name"].asString();
+            close(stream->udp_socket);
+            stream->udp_socket = -1;
+            break;
+        }
+    }
+    return true;
+}
+
+// ================== 帧输出模块 ==================
+// 拼接/无界面模式下，各路解码线程通过appsink把I420帧交到这里；
+// 无界面模式下共享内存传输的流交出从共享内存拷出并确认未被覆盖的BGR帧
+struct DecodedFrame {
+    int stream_id;
+    int width;
+    int height;
+    const uint8_t* data;
+    size_t size;
+    GstClockTime pts;
+    const char* format;   // "I420" 或 "BGR"
+};
+typedef std::function<void(const DecodedFrame&)> FrameCallback;
+
+std::mutex frame_callback_mutex;
+FrameCallback frame_callback;
+
+// 注册帧回调（无界面模式），回调在各路解码线程中并发调用
+void set_frame_callback(FrameCallback callback) {
+    std::lock_guard<std::mutex> lock(frame_callback_mutex);
+    frame_callback = callback;
+}
+
+// 无界面模式默认的帧消费者：按路统计帧数、数据量与平均亮度，每5秒输出一次。
+// 回调已由frame_callback_mutex串行化，这里无需再加锁
+class FrameStatsConsumer {
+public:
+    void operator()(const DecodedFrame& frame) {
+        Stats& stats = streams_[frame.stream_id];
+        auto now = std::chrono::steady_clock::now();
+        if (stats.frames == 0) stats.since = now;
+        stats.frames++;
+        stats.bytes += frame.size;
+        stats.luma = average_luma(frame);
+        if (now - stats.since >= std::chrono::seconds(5)) {
+            double seconds = std::chrono::duration<double>(now - stats.since).count();
+            std::cout << "[流" << frame.stream_id << "][帧回调] " << frame.width << "x" << frame.height
+                      << " " << frame.format << "，" << stats.frames / seconds << " fps，"
+                      << stats.bytes * 8 / seconds / 1e6 << " Mbps，平均亮度 " << stats.luma << std::endl;
+            stats = Stats();
+        }
+    }
+
+private:
+    struct Stats {
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        double luma = 0;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    // 每隔若干像素采样：I420取Y平面，BGR按(B+2G+R)/4近似
+    static double average_luma(const DecodedFrame& frame) {
+        const size_t pixels = (size_t)frame.width * frame.height;
+        const size_t step = 16;
+        uint64_t sum = 0, count = 0;
+        if (strcmp(frame.format, "BGR") == 0) {
+            for (size_t i = 0; i < pixels && i * 3 + 2 < frame.size; i += step, ++count) {
+                const uint8_t* p = frame.data + i * 3;
+                sum += (p[0] + 2 * p[1] + p[2]) / 4;
+            }
+        } else {
+            for (size_t i = 0; i < pixels && i < frame.size; i += step, ++count) sum += frame.data[i];
+        }
+        return count ? (double)sum / count : 0;
+    }
+
+    std::map<int, Stats> streams_;
+};
+
+// 将多路画面按网格拼接到一个窗口，每路对应compositor的一个输入
+class MosaicView {
+public:
+    bool start() {
+        pipeline_ = gst_parse_launch(
+            "compositor name=mix background=black ! videoconvert ! autovideosink sync=false", nullptr);
+        if (!pipeline_) return false;
+        compositor_ = gst_bin_get_by_name(GST_BIN(pipeline_), "mix");
+        gst_element_set_state(pipeline_, GST_STATE_PLAYING);
+        return true;
+    }
+
+    void stop() {
+        if (!pipeline_) return;
+        gst_element_set_state(pipeline_, GST_STATE_NULL);
+        for (auto& tile : tiles_) gst_object_unref(tile.second.pad);
+        tiles_.clear();
+        gst_object_unref(compositor_);
+        gst_object_unref(pipeline_);
+        pipeline_ = nullptr;
+    }
+
+    void add_stream(int stream_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pipeline_ || tiles_.count(stream_id)) return;
+        Tile tile;
+        tile.source = gst_element_factory_make("appsrc", nullptr);
+        GstCaps* caps = gst_caps_new_simple("video/x-raw",
+            "format", G_TYPE_STRING, "I420",
+            "width", G_TYPE_INT, TILE_WIDTH,
+            "height", G_TYPE_INT, TILE_HEIGHT,
+            "framerate", GST_TYPE_FRACTION, 0, 1,
+            nullptr);
+        g_object_set(tile.source, "caps", caps, "is-live", TRUE, "do-timestamp", TRUE,
+                     "format", GST_FORMAT_TIME, "max-bytes", (guint64)TILE_WIDTH * TILE_HEIGHT * 3,
+                     nullptr);
+        gst_caps_unref(caps);
+        if (has_property(tile.source, "leaky-type")) {
+            g_object_set(tile.source, "leaky-type", 2, nullptr);  // 显示跟不上时丢弃旧帧
+        }
+
+        gst_bin_add(GST_BIN(pipeline_), tile.source);
+#if GST_CHECK_VERSION(1, 20, 0)
+        tile.pad = gst_element_request_pad_simple(compositor_, "sink_%u");
+#else
+        tile.pad = gst_element_get_request_pad(compositor_, "sink_%u");
+#endif
+        GstPad* src = gst_element_get_static_pad(tile.source, "src");
+        gst_pad_link(src, tile.pad);
+        gst_object_unref(src);
+        gst_element_sync_state_with_parent(tile.source);
+        tiles_[stream_id] = tile;
+        relayout();
+    }
+
+    void remove_stream(int stream_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = tiles_.find(stream_id);
+        if (it == tiles_.end()) return;
+        gst_element_set_state(it->second.source, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(pipeline_), it->second.source);
+        gst_element_release_request_pad(compositor_, it->second.pad);
+        gst_object_unref(it->second.pad);
+        tiles_.erase(it);
+        relayout();
+    }
+
+    void push_frame(const DecodedFrame& frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = tiles_.find(frame.stream_id);
+        if (it == tiles_.end()) return;
+        GstBuffer* buffer = gst_buffer_new_allocate(nullptr, frame.size, nullptr);
+        GstMapInfo map;
+        if (gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+            memcpy(map.data, frame.data, std::min(map.size, frame.size));
+            gst_buffer_unmap(buffer, &map);
+            gst_app_src_push_buffer(GST_APP_SRC(it->second.source), buffer);  // 转移所有权
+        } else {
+            gst_buffer_unref(buffer);
+        }
+    }
+
+private:
+    struct Tile {
+        GstElement* source = nullptr;
+        GstPad* pad = nullptr;
+    };
+
+    // 近似正方形的网格，按流编号顺序排布
+    void relayout() {
+        int count = (int)tiles_.size();
+        if (count == 0) return;
+        int cols = (int)std::ceil(std::sqrt((double)count));
+        int index = 0;
+        for (auto& tile : tiles_) {
+            g_object_set(tile.second.pad,
+                "xpos", (index % cols) * TILE_WIDTH,
+                "ypos", (index / cols) * TILE_HEIGHT,
+                "width", TILE_WIDTH,
+                "height", TILE_HEIGHT,
+                nullptr);
+            ++index;
+        }
+    }
+
+    std::mutex mutex_;
+    GstElement* pipeline_ = nullptr;
+    GstElement* compositor_ = nullptr;
+    std::map<int, Tile> tiles_;
+};
+MosaicView mosaic_view;
+
+// appsink回调：在解码线程中把帧分发到拼接窗口或帧回调
+static GstFlowReturn deliver_decoded_frame(GstAppSink* sink, gpointer user_data) {
+    VideoStream* stream = static_cast<VideoStream*>(user_data);
+    GstSample* sample = gst_app_sink_pull_sample(sink);
+    if (!sample) return GST_FLOW_EOS;
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        DecodedFrame frame = {stream->id, TILE_WIDTH, TILE_HEIGHT, map.data, map.size,
+                              GST_BUFFER_PTS(buffer), "I420"};
+        stream->frames++;
+        if (view_mode == ViewMode::Mosaic) {
+            mosaic_view.push_frame(frame);
+        } else {
+            std::lock_guard<std::mutex> lock(frame_callback_mutex);
+            if (frame_callback) frame_callback(frame);
+        }
+        gst_buffer_unmap(buffer, &map);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// 拼接/无界面模式下把管道中名为frames的appsink接到帧输出
+void attach_frame_output(GstElement* pipeline, VideoStream* stream) {
+    if (view_mode == ViewMode::Window) return;
+    GstElement *frames = gst_bin_get_by_name(GST_BIN(pipeline), "frames");
+    GstAppSinkCallbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.new_sample = deliver_decoded_frame;
+    gst_app_sink_set_callbacks(GST_APP_SINK(frames), &callbacks, stream, nullptr);
+    gst_object_unref(frames);
+    if (view_mode == ViewMode::Mosaic) mosaic_view.add_stream(stream->id);
+}
+
+// ================== 自适应抖动缓冲模块 ==================
+// 持续测量RTP到达抖动与迟到丢包，在上下限之间动态调整rtpjitterbuffer延迟
+struct JitterConfig {
+    bool adaptive = true;
+    int min_ms = 20;
+    int max_ms = 400;
+    int initial_ms = 100;
+    double jitter_multiplier = 4.0;  // 目标延迟 = 抖动 × 倍数 + 余量
+    int margin_ms = 10;
+    int interval_ms = 500;           // 调整周期
+    int stable_windows = 4;          // 连续多少个周期无迟到包后开始收缩
+};
+
+JitterConfig load_jitter_config() {
+    JitterConfig cfg;
+    cfg.adaptive = env_flag("VS_JITTER_ADAPT", cfg.adaptive);
+    cfg.min_ms = env_int("VS_JITTER_MIN_MS", cfg.min_ms);
+    cfg.max_ms = std::max(cfg.min_ms, env_int("VS_JITTER_MAX_MS", cfg.max_ms));
+    cfg.initial_ms = env_int("VS_JITTER_INITIAL_MS", cfg.initial_ms);
+    cfg.jitter_multiplier = env_double("VS_JITTER_MULTIPLIER", cfg.jitter_multiplier);
+    cfg.margin_ms = env_int("VS_JITTER_MARGIN_MS", cfg.margin_ms);
+    cfg.interval_ms = std::max(100, env_int("VS_JITTER_INTERVAL_MS", cfg.interval_ms));
+    return cfg;
+}
+
+// RFC 3550 到达间隔抖动估计，在jitterbuffer的sink pad上逐包更新
+struct JitterMonitor {
+    std::mutex mutex;
+    bool has_previous = false;
+    double previous_arrival_ms = 0;
+    uint32_t previous_rtp_ts = 0;
+    double jitter_ms = 0;
+};
+
+static GstPadProbeReturn measure_interarrival(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    JitterMonitor* monitor = static_cast<JitterMonitor*>(user_data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    guint8 header[8];
+    if (!buffer || gst_buffer_extract(buffer, 0, header, sizeof(header)) != sizeof(header) ||
+        (header[0] >> 6) != 2) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    uint32_t rtp_ts = ((uint32_t)header[4] << 24) | ((uint32_t)header[5] << 16) |
+                      ((uint32_t)header[6] << 8) | header[7];
+    double arrival_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    std::lock_guard<std::mutex> lock(monitor->mutex);
+    if (monitor->has_previous) {
+        // 视频RTP时钟均为90kHz
+        double rtp_delta_ms = (int32_t)(rtp_ts - monitor->previous_rtp_ts) / 90.0;
+        double d = (arrival_ms - monitor->previous_arrival_ms) - rtp_delta_ms;
+        monitor->jitter_ms += (std::fabs(d) - monitor->jitter_ms) / 16.0;
+    }
+    monitor->has_previous = true;
+    monitor->previous_arrival_ms = arrival_ms;
+    monitor->previous_rtp_ts = rtp_ts;
+    return GST_PAD_PROBE_OK;
+}
+
+// 端到端延迟：抖动缓冲输出帧的最后一个包时按PTS记下服务端写入的采集时刻，
+// 该帧到达显示sink时计算采集到显示的延迟；同步显示的sink还要按时钟等待到渲染时刻，一并计入
+struct DelayWindow {
+    double sum_ms = 0;
+    double max_ms = 0;
+    uint64_t count = 0;
+    double avg_ms() const { return count ? sum_ms / count : -1; }
+};
+
+class EndToEndMeter {
+public:
+    void attach(GstElement* pipeline, GstElement* jitterbuffer, const char* sink_name, bool sync) {
+        pipeline_ = pipeline;
+        sync_ = sync;
+        GstPad* jitter_src = gst_element_get_static_pad(jitterbuffer, "src");
+        gst_pad_add_probe(jitter_src, GST_PAD_PROBE_TYPE_BUFFER, on_packet, this, nullptr);
+        gst_object_unref(jitter_src);
+        GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), sink_name);
+        if (!sink) return;
+        GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
+        gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, on_render, this, nullptr);
+        gst_object_unref(sink_pad);
+        gst_object_unref(sink);
+    }
+
+    // 同步显示时的渲染时刻需要管道延迟，由抖动缓冲控制器周期性查询后更新
+    void set_pipeline_latency(GstClockTime latency) { latency_ = latency; }
+
+    // 取出并清空自上次调用以来的统计；interval供抖动缓冲日志，report供周期输出
+    DelayWindow take_interval() { return take(interval_); }
+    DelayWindow take_report() { return take(report_); }
+
+private:
+    static GstPadProbeReturn on_packet(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        EndToEndMeter* meter = static_cast<EndToEndMeter*>(user_data);
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        guint64 ntp = 0;
+        if (!buffer || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)) ||
+            !rtp_read_capture_time(buffer, ntp)) {
+            return GST_PAD_PROBE_OK;
+        }
+        std::lock_guard<std::mutex> lock(meter->mutex_);
+        if (meter->pending_.size() >= 256) meter->pending_.erase(meter->pending_.begin());  // 解码前被丢弃的帧
+        meter->pending_[GST_BUFFER_PTS(buffer)] = ntp;
+        return GST_PAD_PROBE_OK;
+    }
+
+    static GstPadProbeReturn on_render(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+        EndToEndMeter* meter = static_cast<EndToEndMeter*>(user_data);
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        if (!buffer) return GST_PAD_PROBE_OK;
+        const GstClockTime pts = GST_BUFFER_PTS(buffer);
+        guint64 capture_ntp = 0;
+        {
+            std::lock_guard<std::mutex> lock(meter->mutex_);
+            auto it = meter->pending_.find(pts);
+            if (it == meter->pending_.end()) return GST_PAD_PROBE_OK;
+            capture_ntp = it->second;
+            meter->pending_.erase(meter->pending_.begin(), ++it);
+        }
+        double delay_ms = (ntp_diff_ns(wallclock_ntp(), capture_ntp) +
+                           (gint64)meter->render_wait_ns(pad, pts)) / 1e6;
+        std::lock_guard<std::mutex> lock(meter->mutex_);
+        for (DelayWindow* window : {&meter->interval_, &meter->report_}) {
+            window->sum_ms += delay_ms;
+            window->max_ms = window->count ? std::max(window->max_ms, delay_ms) : delay_ms;
+            window->count++;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    // sync=true的sink在 base_time + running_time + 管道延迟 时刻渲染
+    GstClockTime render_wait_ns(GstPad* pad, GstClockTime pts) {
+        if (!sync_) return 0;
+        GstEvent* event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+        if (!event) return 0;
+        GstSegment segment;
+        gst_event_copy_segment(event, &segment);
+        gst_event_unref(event);
+        GstClockTime running = gst_segment_to_running_time(&segment, GST_FORMAT_TIME, pts);
+        GstClock* clock = gst_element_get_clock(pipeline_);
+        if (!clock) return 0;
+        GstClockTime now = gst_clock_get_time(clock);
+        gst_object_unref(clock);
+        if (!GST_CLOCK_TIME_IS_VALID(running)) return 0;
+        GstClockTime render_at = gst_element_get_base_time(pipeline_) + running + latency_.load();
+        return render_at > now ? render_at - now : 0;
+    }
+
+    DelayWindow take(DelayWindow& window) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        DelayWindow taken = window;
+        window = DelayWindow();
+        return taken;
+    }
+
+    GstElement* pipeline_ = nullptr;
+    bool sync_ = false;
+    std::atomic<GstClockTime> latency_{0};
+    std::mutex mutex_;
+    std::map<GstClockTime, guint64> pending_;  // PTS → 采集时刻（NTP）
+    DelayWindow interval_;
+    DelayWindow report_;
+};
+
+// VS_JITTER_LOG：所有视频流写同一个CSV文件，以stream列区分，表头只在新文件中写一次
+class JitterLog {
+public:
+    static JitterLog& instance() {
+        static JitterLog log;
+        return log;
+    }
+
+    bool enabled() const { return enabled_; }
+
+    void write(const std::string& row) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out_ << row;
+        out_.flush();
+    }
+
+private:
+    JitterLog() {
+        const char* path = getenv("VS_JITTER_LOG");
+        if (!path || !*path) return;
+        struct stat st;
+        bool fresh = stat(path, &st) != 0 || st.st_size == 0;
+        out_.open(path, std::ios::app);
+        enabled_ = out_.is_open();
+        if (enabled_ && fresh) {
+            out_ << "stream,elapsed_ms,jitter_ms,late,lost,latency_ms,pipeline_latency_ms,"
+                    "e2e_avg_ms,e2e_max_ms,decision\n";
+        }
+    }
+
+    bool enabled_ = false;
+    std::mutex mutex_;
+    std::ofstream out_;
+};
+
+class JitterController {
+public:
+    JitterController(GstElement* pipeline, GstElement* jitterbuffer, const JitterConfig& cfg,
+                     VideoStream* stream, EndToEndMeter* e2e)
+        : pipeline_(pipeline), jitterbuffer_(jitterbuffer), cfg_(cfg), stream_(stream),
+          tag_("[流" + std::to_string(stream->id) + "]"), e2e_(e2e),
+          latency_ms_(cfg.initial_ms), start_(std::chrono::steady_clock::now()),
+          last_update_(start_) {
+        GstPad* pad = gst_element_get_static_pad(jitterbuffer_, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, measure_interarrival, &monitor_, nullptr);
+        gst_object_unref(pad);
+    }
+
+    // 延迟预算模式下把迟到、丢失的RTP包计入逐级丢弃统计
+    void count_drops(StageDropCounter* late, StageDropCounter* lost) {
+        late_stage_ = late;
+        lost_stage_ = lost;
+    }
+
+    // 在总线循环中周期调用，未到调整周期时直接返回
+    void update() {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_update_ < std::chrono::milliseconds(cfg_.interval_ms)) return;
+        last_update_ = now;
+
+        guint64 late = 0, lost = 0;
+        GstStructure* stats = nullptr;
+        g_object_get(jitterbuffer_, "stats", &stats, nullptr);
+        if (stats) {
+            gst_structure_get_uint64(stats, "num-late", &late);
+            gst_structure_get_uint64(stats, "num-lost", &lost);
+            gst_structure_free(stats);
+        }
+        guint64 late_delta = late - last_late_;
+        guint64 lost_delta = lost - last_lost_;
+        last_late_ = late;
+        last_lost_ = lost;
+        if (late_stage_) late_stage_->count_drop(late_delta);
+        if (lost_stage_) lost_stage_->count_drop(lost_delta);
+        // 丢包后的帧缺少参考，不等下一个周期关键帧，立即请求服务端补发
+        if (lost_delta > 0) stream_->keyframe_requested = true;
+
+        double jitter_ms;
+        {
+            std::lock_guard<std::mutex> lock(monitor_.mutex);
+            jitter_ms = monitor_.jitter_ms;
+        }
+        int target = clamp((int)(jitter_ms * cfg_.jitter_multiplier) + cfg_.margin_ms);
+
+        // 出现迟到丢包时快速增大；网络平稳若干周期后每周期收缩一半差距
+        int new_latency = latency_ms_;
+        const char* decision = "保持";
+        if (late_delta > 0) {
+            stable_windows_ = 0;
+            new_latency = clamp(std::max(target, latency_ms_ * 3 / 2));
+            decision = "迟到丢包，增大";
+        } else if (target > latency_ms_) {
+            stable_windows_ = 0;
+            new_latency = target;
+            decision = "抖动增大，增大";
+        } else if (++stable_windows_ >= cfg_.stable_windows && target < latency_ms_) {
+            new_latency = clamp(std::max(target, (latency_ms_ + target) / 2));
+            decision = "网络平稳，收缩";
+        }
+
+        if (cfg_.adaptive && new_latency != latency_ms_) {
+            g_object_set(jitterbuffer_, "latency", (guint)new_latency, nullptr);
+        } else {
+            new_latency = latency_ms_;
+            if (!cfg_.adaptive) decision = "固定";
+        }
+
+        // 接收端管道延迟（抖动缓冲+解码+渲染），不含网络单向传输时间
+        gboolean live = FALSE;
+        GstClockTime min_latency = 0, max_latency = 0;
+        double pipeline_ms = -1;
+        if (gst_element_query_latency(pipeline_, &live, &min_latency, &max_latency)) {
+            pipeline_ms = (double)min_latency / GST_MSECOND;
+            e2e_->set_pipeline_latency(min_latency);
+        }
+        // 采集到显示的端到端延迟，含网络传输；服务端未写入采集时刻时为-1
+        DelayWindow e2e = e2e_->take_interval();
+
+        if (new_latency != latency_ms_ || late_delta > 0 || lost_delta > 0) {
+            std::cout << tag_ << "[抖动缓冲] 抖动 " << jitter_ms << "ms，迟到 +" << late_delta
+                      << "，丢失 +" << lost_delta << "，延迟 " << latency_ms_ << "→"
+                      << new_latency << "ms (" << decision << ")，接收端延迟 "
+                      << pipeline_ms << "ms，端到端 " << e2e.avg_ms() << "ms" << std::endl;
+        }
+        if (JitterLog::instance().enabled()) {
+            std::ostringstream row;
+            row << stream_->id << "," << std::chrono::duration_cast<std::chrono::milliseconds>(now - start_).count()
+                << "," << jitter_ms << "," << late_delta << "," << lost_delta << ","
+                << new_latency << "," << pipeline_ms << "," << e2e.avg_ms() << ","
+                << (e2e.count ? e2e.max_ms : -1) << "," << decision << "\n";
+            JitterLog::instance().write(row.str());
+        }
+        latency_ms_ = new_latency;
+    }
+
+private:
+    int clamp(int value) const {
+        return std::min(cfg_.max_ms, std::max(cfg_.min_ms, value));
+    }
+
+    GstElement* pipeline_;
+    GstElement* jitterbuffer_;
+    JitterConfig cfg_;
+    VideoStream* stream_;
+    std::string tag_;  // 日志前缀，区分多路视频流
+    EndToEndMeter* e2e_;
+    JitterMonitor monitor_;
+    int latency_ms_;
+    int stable_windows_ = 0;
+    guint64 last_late_ = 0;
+    guint64 last_lost_ = 0;
+    StageDropCounter* late_stage_ = nullptr;
+    StageDropCounter* lost_stage_ = nullptr;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point last_update_;
+};
+
 // ================== 视频接收模块 ==================
-void start_video_reception(const std::string& server_ip) {
+// 按编码格式选择解包与解码元素，decode_queue插在两者之间
+std::string decoder_pipeline_desc(const std::string& codec, const std::string& decode_queue = "") {
+    const DecoderElements* elements = find_decoder(codec);
+    if (!elements) elements = &DECODERS[0];
+    return std::string(elements->depay) + " name=depay ! " + decode_queue + elements->decoder + " name=decoder";
+}
+
+// 帧追踪：抖动缓冲按RTP时间戳记录每帧首包到达时刻，帧的最后一个包离开时
+// 以输出PTS作为帧标识补记该帧在抖动缓冲中的区间，之后各阶段都以PTS配对
+struct JitterTrace {
+    std::mutex mutex;
+    std::map<uint32_t, uint64_t> arrivals;  // RTP时间戳 → 首包到达时刻
+    int stream = 0;
+};
+
+static bool rtp_timestamp(GstBuffer* buffer, uint32_t& ts, bool& marker) {
+    guint8 header[8];
+    if (gst_buffer_extract(buffer, 0, header, sizeof(header)) != sizeof(header)) return false;
+    marker = (header[1] & 0x80) != 0;
+    ts = ((uint32_t)header[4] << 24) | ((uint32_t)header[5] << 16) |
+         ((uint32_t)header[6] << 8) | header[7];
+    return true;
+}
+
+static GstPadProbeReturn trace_jitter_in(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    JitterTrace* trace = static_cast<JitterTrace*>(user_data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    uint32_t ts;
+    bool marker;
+    if (!buffer || !rtp_timestamp(buffer, ts, marker)) return GST_PAD_PROBE_OK;
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    if (trace->arrivals.count(ts)) return GST_PAD_PROBE_OK;
+    if (trace->arrivals.size() >= 256) trace->arrivals.erase(trace->arrivals.begin());  // 丢失marker的帧
+    trace->arrivals[ts] = FrameTracer::now_ns();
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn trace_jitter_out(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    JitterTrace* trace = static_cast<JitterTrace*>(user_data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    uint32_t ts;
+    bool marker;
+    if (!buffer || !rtp_timestamp(buffer, ts, marker) || !marker) return GST_PAD_PROBE_OK;
+    int64_t frame = trace_frame_id(buffer, FrameRate());
+    uint64_t arrival = 0;
+    {
+        std::lock_guard<std::mutex> lock(trace->mutex);
+        auto it = trace->arrivals.find(ts);
+        if (it != trace->arrivals.end()) {
+            arrival = it->second;
+            trace->arrivals.erase(it);
+        }
+    }
+    if (arrival) {
+        trace_begin("jitterbuffer", frame, trace->stream, arrival);
+        trace_end("jitterbuffer", frame, trace->stream);
+    }
+    trace_begin("depay", frame, trace->stream);
+    return GST_PAD_PROBE_OK;
+}
+
+// 解码前队列满时leaky丢弃的是压缩帧，其后的帧参考缺失，需请求关键帧恢复
+static void on_decode_overrun(GstElement*, gpointer user_data) {
+    static_cast<VideoStream*>(user_data)->keyframe_requested = true;
+}
+
+// 解码输出协商出帧率后，按实际帧间隔重新为解码前后的队列定容
+struct BudgetQueues {
+    LatencyBudget budget;
+    GstElement* pipeline = nullptr;
+    std::string tag;
+    double frame_ms = 0;
+};
+
+static GstPadProbeReturn resize_budget_queues(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    BudgetQueues* queues = static_cast<BudgetQueues*>(user_data);
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (!event || GST_EVENT_TYPE(event) != GST_EVENT_CAPS) return GST_PAD_PROBE_OK;
+    GstCaps* caps = nullptr;
+    gint num = 0, den = 0;
+    gst_event_parse_caps(event, &caps);
+    if (!caps || !gst_structure_get_fraction(gst_caps_get_structure(caps, 0), "framerate", &num, &den) ||
+        num <= 0 || den <= 0) {
+        return GST_PAD_PROBE_OK;
+    }
+    double frame_ms = 1000.0 * den / num;
+    if (frame_ms == queues->frame_ms) return GST_PAD_PROBE_OK;
+    queues->frame_ms = frame_ms;
+
+    const std::pair<const char*, double> stages[] = {{"q_decode", SHARE_DECODE}, {"q_render", SHARE_RENDER}};
+    for (const auto& stage : stages) {
+        GstElement* queue = gst_bin_get_by_name(GST_BIN(queues->pipeline), stage.first);
+        if (!queue) continue;
+        g_object_set(queue, "max-size-buffers",
+                     (guint)budget_buffers(queues->budget, stage.second, frame_ms), nullptr);
+        gst_object_unref(queue);
+    }
+    std::cout << queues->tag << "[延迟预算] 帧率 " << (double)num / den << "fps，解码队列 "
+              << budget_buffers(queues->budget, SHARE_DECODE, frame_ms) << " 帧，显示队列 "
+              << budget_buffers(queues->budget, SHARE_RENDER, frame_ms) << " 帧" << std::endl;
+    return GST_PAD_PROBE_OK;
+}
+
+void start_video_reception(ServerConnection* conn, VideoStream* stream) {
     GstElement *pipeline = nullptr;
-    gst_init(nullptr, nullptr);
+    const std::string tag = "[流" + std::to_string(stream->id) + "]";
+    JitterConfig jitter_cfg = load_jitter_config();
+
+    // 延迟预算模式：抖动缓冲上限取预算份额，解码前与显示前插入有界的丢旧队列
+    // 非预算模式下解码前也放一个队列，使每路解码在独立线程中进行
+    LatencyBudget budget = load_latency_budget();
+    const double frame_ms = 1000.0 / 30;  // 解码输出协商出帧率前的估计，之后由resize_budget_queues修正
+    std::string decode_queue = "queue ! ", render_queue, sink_options;
+    if (budget.enabled) {
+        jitter_cfg.max_ms = std::min(jitter_cfg.max_ms, budget_ms(budget, SHARE_JITTER));
+        jitter_cfg.min_ms = std::min(jitter_cfg.min_ms, jitter_cfg.max_ms);
+        jitter_cfg.initial_ms = budget.mode == LatencyMode::Lowest ? jitter_cfg.min_ms :
+            std::min(jitter_cfg.initial_ms, jitter_cfg.max_ms);
+        decode_queue = leaky_queue_desc("q_decode",
+            budget_buffers(budget, SHARE_DECODE, frame_ms), 0) + " ! ";
+        render_queue = leaky_queue_desc("q_render",
+            budget_buffers(budget, SHARE_RENDER, frame_ms), 0) + " ! ";
+        if (budget.mode == LatencyMode::Lowest) sink_options = " sync=false";
+    }
 
+    std::string sink_desc = view_mode == ViewMode::Window ?
+        "autovideosink name=render" + sink_options :
+        "appsink name=frames sync=false max-buffers=2 drop=true";
     std::string pipeline_str = 
-        "udpsrc port=" + std::to_string(VIDEO_PORT) + " ! "
-        "application/x-rtp,media=video,encoding-name=H264 ! "
-        "rtpjitterbuffer latency=100 ! "
-        "rtph264depay ! avdec_h264 ! videoconvert ! videoscale ! "
-        "video/x-raw,width=640,height=360 ! autovideosink";
+        "udpsrc name=udp ! "
+        "application/x-rtp,media=video,encoding-name=" + conn->codec + " ! "
+        "rtpjitterbuffer name=jitter latency=" + std::to_string(jitter_cfg.initial_ms) + " ! " +
+        decoder_pipeline_desc(conn->codec, decode_queue) + " ! videoconvert ! videoscale ! "
+        "video/x-raw," + (view_mode == ViewMode::Window ? "" : "format=I420,") +
+        "width=" + std::to_string(TILE_WIDTH) +
+        ",height=" + std::to_string(TILE_HEIGHT) + " ! " + render_queue + sink_desc;
 
     pipeline = gst_parse_launch(pipeline_str.c_str(), nullptr);
+    if (!pipeline) {
+        std::cerr << tag << "管道创建失败" << std::endl;
+        close(stream->udp_socket);
+        return;
+    }
+
+    // udpsrc直接使用预先绑定的socket，端口在告知服务端前就已占用
+    GstElement *udpsrc = gst_bin_get_by_name(GST_BIN(pipeline), "udp");
+    GSocket *gsocket = g_socket_new_from_fd(stream->udp_socket, nullptr);
+    g_object_set(udpsrc, "socket", gsocket, "close-socket", TRUE, nullptr);
+    g_object_unref(gsocket);
+    gst_object_unref(udpsrc);
+    stream->udp_socket = -1;
+
+    attach_frame_output(pipeline, stream);
+
+    GstElement *jitterbuffer = gst_bin_get_by_name(GST_BIN(pipeline), "jitter");
+    EndToEndMeter e2e_meter;
+    e2e_meter.attach(pipeline, jitterbuffer, view_mode == ViewMode::Window ? "render" : "frames",
+                     view_mode == ViewMode::Window && sink_options.empty());
+    JitterController jitter_controller(pipeline, jitterbuffer, jitter_cfg, stream, &e2e_meter);
+
+    // 帧追踪：抖动缓冲 → 解包 → 解码 → 转换缩放与显示队列
+    JitterTrace jitter_trace;
+    jitter_trace.stream = stream->id;
+    if (trace_enabled()) {
+        GstPad *jitter_sink = gst_element_get_static_pad(jitterbuffer, "sink");
+        gst_pad_add_probe(jitter_sink, GST_PAD_PROBE_TYPE_BUFFER, trace_jitter_in, &jitter_trace, nullptr);
+        gst_object_unref(jitter_sink);
+        GstPad *jitter_src = gst_element_get_static_pad(jitterbuffer, "src");
+        gst_pad_add_probe(jitter_src, GST_PAD_PROBE_TYPE_BUFFER, trace_jitter_out, &jitter_trace, nullptr);
+        gst_object_unref(jitter_src);
+        trace_pad(pipeline, "depay", "src", {"depay", "decode", false, FrameRate(), stream->id});
+        trace_pad(pipeline, "decoder", "src", {"decode", "render", false, FrameRate(), stream->id});
+        trace_pad(pipeline, view_mode == ViewMode::Window ? "render" : "frames", "sink",
+                  {"render", nullptr, false, FrameRate(), stream->id});
+    }
+    DropAccounting drops;
+    BudgetQueues budget_queues;
+    if (budget.enabled) {
+        drops.add(pipeline, "q_decode");
+        drops.add(pipeline, "q_render");
+        // 抖动缓冲以RTP包计数
+        jitter_controller.count_drops(drops.add(nullptr, "jitter_late"), drops.add(nullptr, "jitter_lost"));
+
+        GstElement *decode_queue_element = gst_bin_get_by_name(GST_BIN(pipeline), "q_decode");
+        if (decode_queue_element) {
+            g_signal_connect(decode_queue_element, "overrun", G_CALLBACK(on_decode_overrun), stream);
+            gst_object_unref(decode_queue_element);
+        }
+        budget_queues.budget = budget;
+        budget_queues.pipeline = pipeline;
+        budget_queues.tag = tag;
+        budget_queues.frame_ms = frame_ms;
+        GstElement *decoder = gst_bin_get_by_name(GST_BIN(pipeline), "decoder");
+        if (decoder) {
+            GstPad *decoder_src = gst_element_get_static_pad(decoder, "src");
+            gst_pad_add_probe(decoder_src, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                              resize_budget_queues, &budget_queues, nullptr);
+            gst_object_unref(decoder_src);
+            gst_object_unref(decoder);
+        }
+    }
+    auto last_report = std::chrono::steady_clock::now();
+    uint64_t last_frames = 0;
+    guint64 last_qos_timestamp = 0;
+    std::cout << tag << " 摄像头" << stream->camera_index << " @ "
+              << conn->server_info["ip"].asString() << " 接收端口 " << stream->video_port << std::endl;
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
 
     GstBus *bus = gst_element_get_bus(pipeline);
-    while (is_connected && !exit_program) {
+    while (conn->connected && !exit_program) {
         GstMessage *msg = gst_bus_timed_pop_filtered(bus, 
             100 * GST_MSECOND, // 将超时设置为100毫秒
-            static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_QOS));
+            static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_QOS |
+                                        GST_MESSAGE_LATENCY));
+        jitter_controller.update();
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(5)) {
+            if (!drops.empty()) {
+                std::cout << tag << "[延迟预算] 累计丢弃: " << drops.summary() << std::endl;
+            }
+            DelayWindow e2e = e2e_meter.take_report();
+            if (e2e.count > 0) {
+                std::cout << tag << " 端到端延迟（采集→显示）平均 " << e2e.avg_ms()
+                          << "ms，最大 " << e2e.max_ms << "ms" << std::endl;
+            }
+            if (view_mode == ViewMode::Headless) {
+                uint64_t frames = stream->frames;
+                std::cout << tag << " 输出 " << (frames - last_frames) /
+                    std::chrono::duration<double>(now - last_report).count() << " fps" << std::endl;
+                last_frames = frames;
+            }
+            last_report = now;
+        }
         
         if (msg) {
             switch (GST_MESSAGE_TYPE(msg)) {
+                case GST_MESSAGE_LATENCY:
+                    // 抖动缓冲延迟变化后重新分配管道延迟
+                    gst_bin_recalculate_latency(GST_BIN(pipeline));
+                    break;
                 case GST_MESSAGE_QOS: {
                     guint64 timestamp;
                     gst_message_parse_qos(msg, nullptr, nullptr, nullptr, &timestamp, nullptr);
-                    static guint64 last_timestamp = 0;
-                    if (timestamp - last_timestamp > 20000000) {
-                        receiver_status.store(300);
+                    if (timestamp - last_qos_timestamp > 20000000) {
+                        stream->status.store(300);
                     } else {
-                        receiver_status.store(200);
+                        stream->status.store(200);
                     }
-                    last_timestamp = timestamp;
+                    last_qos_timestamp = timestamp;
                     break;
                 }
                 case GST_MESSAGE_ERROR: {
                     gchar *debug;
                     GError *err;
                     gst_message_parse_error(msg, &err, &debug);
-                    std::cerr << "视频错误: " << err->message << std::endl;
+                    std::cerr << tag << "视频错误: " << err->message << std::endl;
                     g_error_free(err);
                     g_free(debug);
                     break;
                 }
                 case GST_MESSAGE_EOS:
-                    std::cout << "视频流结束" << std::endl;
+                    std::cout << tag << "视频流结束" << std::endl;
                     break;
                 default: break;
             }
@@ -224,16 +1272,227 @@ void start_video_reception(const std::string& server_ip) {
         }
     }
 
+    gst_object_unref(bus);
     gst_element_set_state(pipeline, GST_STATE_NULL);
+    if (view_mode == ViewMode::Mosaic) mosaic_view.remove_stream(stream->id);
+    gst_object_unref(jitterbuffer);
     gst_object_unref(pipeline);
 }
 
+// 共享内存传输：直接读取服务端写入的原始帧，无需解码
+void start_shm_reception(ServerConnection* conn, VideoStream* stream) {
+    const std::string tag = "[流" + std::to_string(stream->id) + "]";
+    ShmRingReader ring;
+    // 服务端打开摄像头后才创建共享内存，稍作等待
+    for (int i = 0; i < 50 && conn->connected && !ring.open(stream->shm_name); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (!conn->connected) return;
+    if (!ring.open(stream->shm_name)) {
+        std::cerr << tag << "无法打开共享内存 " << stream->shm_name << std::endl;
+        return;
+    }
+    std::cout << tag << " 摄像头" << stream->camera_index << " @ 本机共享内存 "
+              << stream->shm_name << std::endl;
+
+    // 显示路径需转换缩放；无界面模式只把帧拷入复用的缓冲交给帧回调，不经过GStreamer
+    GstElement *pipeline = nullptr;
+    GstAppSrc *source = nullptr;
+    if (view_mode != ViewMode::Headless) {
+        std::string pipeline_str =
+            "appsrc name=raw is-live=true do-timestamp=true format=time ! "
+            "videoconvert ! videoscale ! "
+            "video/x-raw," + std::string(view_mode == ViewMode::Window ? "" : "format=I420,") +
+            "width=" + std::to_string(TILE_WIDTH) +
+            ",height=" + std::to_string(TILE_HEIGHT) + " ! " +
+            (view_mode == ViewMode::Window ? "autovideosink sync=false" :
+                                             "appsink name=frames sync=false max-buffers=2 drop=true");
+        pipeline = gst_parse_launch(pipeline_str.c_str(), nullptr);
+        if (!pipeline) {
+            std::cerr << tag << "管道创建失败" << std::endl;
+            return;
+        }
+        source = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(pipeline), "raw"));
+        attach_frame_output(pipeline, stream);
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    }
+
+    uint32_t caps_width = 0, caps_height = 0;
+    std::vector<uint8_t> frame_copy;  // 无界面模式：先拷出再校验，回调不会看到被覆盖的数据
+    auto last_report = std::chrono::steady_clock::now();
+    uint64_t last_frames = 0;
+    double latency_ms = 0;
+    while (conn->connected && !exit_program) {
+        ShmFrame shm_frame;
+        if (!ring.acquire(shm_frame, 100)) {
+            if (ring.writer_closed()) {
+                std::cout << tag << "视频流结束" << std::endl;
+                break;
+            }
+            continue;
+        }
+        latency_ms = (monotonic_ns() - shm_frame.pts_ns) / 1e6;
+        // 采集时刻与本机单调时钟一致，可直接记为该帧从采集到读取的区间
+        trace_begin("shm_capture_to_read", shm_frame.seq, stream->id, shm_frame.pts_ns);
+        trace_end("shm_capture_to_read", shm_frame.seq, stream->id);
+        TraceSpan deliver_span("shm_deliver", shm_frame.seq, stream->id);
+
+        if (!source) {
+            frame_copy.assign(shm_frame.data, shm_frame.data + shm_frame.size);
+            if (ring.release(shm_frame)) {
+                DecodedFrame frame = {stream->id, (int)shm_frame.width, (int)shm_frame.height,
+                                      frame_copy.data(), frame_copy.size(), shm_frame.pts_ns, "BGR"};
+                stream->frames++;
+                std::lock_guard<std::mutex> lock(frame_callback_mutex);
+                if (frame_callback) frame_callback(frame);
+            }
+        } else {
+            if (shm_frame.width != caps_width || shm_frame.height != caps_height) {
+                caps_width = shm_frame.width;
+                caps_height = shm_frame.height;
+                GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                    "format", G_TYPE_STRING, "BGR",
+                    "width", G_TYPE_INT, (int)caps_width,
+                    "height", G_TYPE_INT, (int)caps_height,
+                    "framerate", GST_TYPE_FRACTION, 0, 1,
+                    nullptr);
+                gst_app_src_set_caps(source, caps);
+                gst_caps_unref(caps);
+            }
+            GstBuffer *buffer = gst_buffer_new_allocate(nullptr, shm_frame.size, nullptr);
+            gst_buffer_fill(buffer, 0, shm_frame.data, shm_frame.size);
+            if (ring.release(shm_frame)) {
+                gst_app_src_push_buffer(source, buffer);  // 转移所有权
+                stream->frames++;
+            } else {
+                gst_buffer_unref(buffer);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(5)) {
+            uint64_t frames = stream->frames;
+            std::cout << tag << " 本地 " << (frames - last_frames) /
+                std::chrono::duration<double>(now - last_report).count() << " fps，采集到读取 "
+                << latency_ms << " ms，落后跳过 " << ring.dropped()
+                << " 帧，读取中被覆盖 " << ring.torn() << " 帧" << std::endl;
+            last_frames = frames;
+            last_report = now;
+        }
+    }
+
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        if (view_mode == ViewMode::Mosaic) mosaic_view.remove_stream(stream->id);
+        gst_object_unref(source);
+        gst_object_unref(pipeline);
+    }
+}
+
+// ================== 连接管理模块 ==================
+int connect_server(const Json::Value& server) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server["heartbeat_port"].asInt());
+    inet_pton(AF_INET, server["ip"].asString().c_str(), &addr.sin_addr);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// 已完成摄像头选择的连接：启动心跳与各路接收线程，直到连接断开
+void run_streams(ServerConnection* conn) {
+    conn->connected = true;
+    std::thread heartbeat(handle_heartbeat, conn);
+    for (auto& stream : conn->streams) {
+        stream->thread = std::thread(stream->shm_name.empty() ? start_video_reception : start_shm_reception,
+                                     conn, stream.get());
+    }
+    heartbeat.join();
+    for (auto& stream : conn->streams) {
+        if (stream->thread.joinable()) stream->thread.join();
+        if (stream->udp_socket != -1) close(stream->udp_socket);
+    }
+    conn->streams.clear();
+}
+
+// 每个服务端连接的后台线程，异常断开时按原摄像头自动重连
+void supervise_connection(ServerConnection* conn) {
+    run_streams(conn);
+    while (conn->abnormal_disconnect && !conn->stop_requested && !exit_program) {
+        std::cout << "尝试重新连接 " << conn->server_info["ip"].asString() << "..." << std::endl;
+        conn->abnormal_disconnect = false;
+        int retries = 3;
+        bool reconnected = false;
+        while (retries-- > 0 && !conn->stop_requested && !exit_program) {
+            conn->heartbeat_socket = connect_server(conn->server_info);
+            if (conn->heartbeat_socket != -1) {
+                // 自动选择之前的摄像头
+                std::vector<int> cameras = select_cameras(conn, conn->camera_indices);
+                if (!cameras.empty() && send_camera_selection(conn, cameras)) {
+                    reconnected = true;
+                    break;
+                }
+                for (auto& stream : conn->streams) close(stream->udp_socket);
+                conn->streams.clear();
+                close(conn->heartbeat_socket);
+                conn->heartbeat_socket = -1;
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        }
+        if (!reconnected) {
+            std::cerr << "重连失败: " << conn->server_info["ip"].asString() << std::endl;
+            break;
+        }
+        run_streams(conn);
+    }
+    conn->finished = true;
+}
+
 // ================== 主控制逻辑 ==================
-int main() {
+int main(int argc, char* argv[]) {
+    // 注册信号处理（不设SA_RESTART，阻塞的终端读取被中断后检查退出标志）
+    main_thread = pthread_self();
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    gst_init(&argc, &argv);
+    FrameTracer::instance().configure("client");
+    const char* view = getenv("VS_CLIENT_VIEW");  // window / mosaic / headless
+    if (view && strcmp(view, "mosaic") == 0) {
+        view_mode = ViewMode::Mosaic;
+        if (!mosaic_view.start()) {
+            std::cerr << "拼接窗口创建失败，改为每路独立窗口" << std::endl;
+            view_mode = ViewMode::Window;
+        }
+    } else if (view && strcmp(view, "headless") == 0) {
+        view_mode = ViewMode::Headless;
+        set_frame_callback(FrameStatsConsumer());
+    }
+
     std::thread discovery_thread(discover_servers);
-    std::thread video_thread;
+    std::list<std::unique_ptr<ServerConnection>> connections;
 
     while (!exit_program) {
+        // 回收已结束的连接
+        for (auto it = connections.begin(); it != connections.end();) {
+            if ((*it)->finished) {
+                (*it)->supervisor.join();
+                it = connections.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
         // 显示服务端列表
         std::cout << "\n===== 可用服务端列表 =====" << std::endl;
         {
@@ -243,17 +1502,35 @@ int main() {
                         << " (" << servers[i]["ip"].asString() << ")" << std::endl;
             }
         }
+        if (!connections.empty()) {
+            std::cout << "----- 当前连接 -----" << std::endl;
+            int index = 0;
+            for (const auto& conn : connections) {
+                std::cout << "<" << index++ << "> " << conn->server_info["ip"].asString() << " 摄像头";
+                for (int cam : conn->camera_indices) std::cout << " " << cam;
+                std::cout << (conn->connected ? "" : " (重连中)") << std::endl;
+            }
+        }
 
         // 用户选择
-        std::cout << "\n输入编号选择服务端 (r刷新/q退出): ";
+        std::cout << "\n输入编号选择服务端 (r刷新/d<编号>断开连接/q退出): ";
         std::string input;
         std::getline(std::cin, input);
-        if (input == "q") {
+        if (input == "q" || !std::cin) {
             exit_program = true;
             break;
         } else if (input == "r") {
+            std::lock_guard<std::mutex> lock(servers_mutex);
             servers.clear();
             continue;
+        } else if (!input.empty() && input[0] == 'd') {
+            int target = atoi(input.c_str() + 1);
+            int index = 0;
+            for (auto& conn : connections) {
+                if (index++ != target) continue;
+                conn->stop_requested = true;  // 心跳线程轮询到后自行关闭连接
+            }
+            continue;
         }
 
         // 添加输入验证和异常捕获
@@ -268,99 +1545,41 @@ int main() {
             continue;
         }
 
-
         // 建立连接
-        Json::Value target;
+        std::unique_ptr<ServerConnection> conn(new ServerConnection);
         {
             std::lock_guard<std::mutex> lock(servers_mutex);
-            if (choice < 0 || choice >= servers.size()) {
-            std::cerr << "错误：无效的服务器编号！" << std::endl;
-            continue;
-            }
-            target = servers[choice];
-        }
-
-        heartbeat_socket = socket(AF_INET, SOCK_STREAM, 0);
-        struct sockaddr_in addr;
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(target["heartbeat_port"].asInt());
-        inet_pton(AF_INET, target["ip"].asString().c_str(), &addr.sin_addr);
-
-        last_server_info = target; // 保存上次连接信息
-
-        // 处理连接断开后的逻辑
-        if (abnormal_disconnect.load()) {
-            std::cout << "尝试重新连接..." << std::endl;
-            int retries = 3;
-            while (retries-- > 0 && !exit_program) {
-                heartbeat_socket = socket(AF_INET, SOCK_STREAM, 0);
-                struct sockaddr_in addr;
-                addr.sin_family = AF_INET;
-                addr.sin_port = htons(last_server_info["heartbeat_port"].asInt());
-                inet_pton(AF_INET, last_server_info["ip"].asString().c_str(), &addr.sin_addr);
-
-                if (connect(heartbeat_socket, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
-                    is_connected = true;
-                    abnormal_disconnect = false;
-
-                    // 自动选择之前的摄像头
-                    int cam_index = select_camera(heartbeat_socket, last_cam_index);
-                    if (cam_index != -1) {
-                        std::thread(handle_heartbeat).detach();
-                        video_thread = std::thread(start_video_reception, last_server_info["ip"].asString());
-                        video_thread.join();
-                        break;
-                    }
-                }
-                close(heartbeat_socket);
-                std::this_thread::sleep_for(std::chrono::seconds(2));
+            if (choice < 0 || choice >= (int)servers.size()) {
+                std::cerr << "错误：无效的服务器编号！" << std::endl;
+                continue;
             }
-            abnormal_disconnect = false;
+            conn->server_info = servers[choice];
         }
 
-        if (connect(heartbeat_socket, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
-            is_connected = true;
-            std::cout << "已连接至服务端: " << target["name"].asString() << std::endl;
-
-            // 选择摄像头
-            int cam_index = select_camera(heartbeat_socket);
-            if (cam_index != -1) {
-                std::thread(handle_heartbeat).detach();
-                video_thread = std::thread(start_video_reception, target["ip"].asString());
-                video_thread.join();
-            }
-
-            // 连接状态监控
-            std::atomic<bool> video_running{true};
-            std::thread([&](){
-                while (video_running && !exit_program) {
-                    if (!is_connected) {
-                        std::cout << "连接已断开，返回服务器列表" << std::endl;
-                        video_running = false; // 触发视频线程退出
-                        break;
-                    }
-                    std::this_thread::sleep_for(std::chrono::seconds(1));
-                }
-            }).detach();
-
-            // 启动视频线程
-            video_thread = std::thread(start_video_reception, target["ip"].asString());
-            video_thread.join();
-            video_running = false;
-
-            // 重置状态
-            is_connected = false;
-            abnormal_disconnect = false;
-            // exit_program = false; // 重置退出标志
-            close(heartbeat_socket);
-        } else {
+        conn->heartbeat_socket = connect_server(conn->server_info);
+        if (conn->heartbeat_socket == -1) {
             std::cerr << "连接失败!" << std::endl;
-            close(heartbeat_socket);
+            continue;
         }
+        std::cout << "已连接至服务端: " << conn->server_info["name"].asString() << std::endl;
+
+        // 选择摄像头，连接转入后台运行，可继续添加其他服务端或摄像头
+        conn->camera_indices = select_cameras(conn.get());
+        if (conn->camera_indices.empty() || !send_camera_selection(conn.get(), conn->camera_indices)) {
+            for (auto& stream : conn->streams) close(stream->udp_socket);
+            close(conn->heartbeat_socket);
+            continue;
+        }
+        conn->supervisor = std::thread(supervise_connection, conn.get());
+        connections.push_back(std::move(conn));
     }
 
     exit_program = true;
+    for (auto& conn : connections) {
+        if (conn->supervisor.joinable()) conn->supervisor.join();
+    }
     discovery_thread.join();
-    if (video_thread.joinable()) video_thread.join();
+    if (view_mode == ViewMode::Mosaic) mosaic_view.stop();
+    FrameTracer::instance().write();
     return 0;
-}
\ No newline at end of file
+}
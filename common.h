@@ -0,0 +1,57 @@
+/* 
+filename: common.h
+author: Linductor
+data: 2026/10/19
+*/
+#ifndef VIDEOSERVER_COMMON_H
+#define VIDEOSERVER_COMMON_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <json/json.h>
+
+// ================== 运行配置 ==================
+// 可选功能通过环境变量开启，未设置时保持默认行为
+inline int env_int(const char* name, int default_value) {
+    const char* value = getenv(name);
+    return (value && *value) ? atoi(value) : default_value;
+}
+
+inline double env_double(const char* name, double default_value) {
+    const char* value = getenv(name);
+    return (value && *value) ? atof(value) : default_value;
+}
+
+inline bool env_flag(const char* name, bool default_value) {
+    const char* value = getenv(name);
+    if (!value || !*value) return default_value;
+    return strcmp(value, "0") != 0 && strcmp(value, "false") != 0;
+}
+
+// ================== 控制消息 ==================
+// 控制连接上的JSON消息以换行结尾（Json::FastWriter的输出格式）
+inline bool send_json(int sock, const Json::Value& message) {
+    std::string json_str = Json::FastWriter().write(message);
+    return send(sock, json_str.c_str(), json_str.size(), MSG_NOSIGNAL) == (ssize_t)json_str.size();
+}
+
+// 读取一条完整的JSON消息；先窥视再按换行位置取出，不会读走后续数据
+inline bool recv_json_line(int sock, Json::Value& message, size_t max_size = 1 << 20) {
+    std::string data;
+    char chunk[4096];
+    while (data.size() < max_size) {
+        ssize_t n = recv(sock, chunk, sizeof(chunk), MSG_PEEK);
+        if (n <= 0) return false;
+        const char* newline = static_cast<const char*>(memchr(chunk, '\n', n));
+        size_t take = newline ? newline - chunk + 1 : n;
+        n = recv(sock, chunk, take, 0);
+        if (n <= 0) return false;
+        data.append(chunk, n);
+        if (newline) return Json::Reader().parse(data, message);
+    }
+    return false;
+}
+
+#endif // VIDEOSERVER_COMMON_H
@@ -0,0 +1,321 @@
+/*
+filename: frame_trace.h
+author: Linductor
+data: 2026/10/19
+*/
+#ifndef VIDEOSERVER_FRAME_TRACE_H
+#define VIDEOSERVER_FRAME_TRACE_H
+
+#include <gst/gst.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "common.h"
+
+// ================== 帧追踪模块 ==================
+// 设置 VS_TRACE=<文件> 后记录每一帧经过各处理阶段的时间区间，退出时写出
+// Chrome trace-event JSON，可直接载入 Perfetto / chrome://tracing 查看单帧耗时。
+// 每个线程写自己的缓冲区，无锁；缓冲区按固定大小的块按需增长，全进程共用一个事件总量上限，
+// 总量用尽或超出记录时长后的事件被丢弃并计数。线程退出后其缓冲区留给之后新建的线程继续使用，
+// 频繁重连时内存不会随线程数增长。
+// 时间戳取 CLOCK_MONOTONIC，同一台主机上两端的追踪文件可以对齐查看。
+
+struct TraceEvent {
+    const char* name;   // 必须是静态字符串
+    uint64_t ts_ns;
+    uint64_t dur_ns;
+    int64_t id;         // 帧标识：服务端为帧序号，客户端为PTS
+    int32_t tid;        // 缓冲区可能先后属于多个线程，逐条记录所属线程
+    int16_t stream;     // 服务端为摄像头索引，客户端为流编号，区分同一进程内的多路
+    char phase;         // 'X' 线程内区间，'b'/'e' 跨线程的异步区间，'i' 瞬时事件
+};
+
+const size_t TRACE_CHUNK_EVENTS = 4096;
+
+// 同一时刻只属于一个线程；块只由当前持有线程追加，写出在所有线程结束后进行
+struct ThreadTraceBuffer {
+    std::vector<std::unique_ptr<TraceEvent[]>> chunks;
+    std::atomic<size_t> count{0};
+    uint64_t dropped = 0;
+};
+
+class FrameTracer {
+public:
+    static FrameTracer& instance() {
+        static FrameTracer tracer;
+        return tracer;
+    }
+
+    // 读取 VS_TRACE / VS_TRACE_SECONDS / VS_TRACE_EVENTS，未设置时不记录任何事件
+    void configure(const std::string& process_name) {
+        const char* path = getenv("VS_TRACE");
+        if (!path || !*path) return;
+        path_ = path;
+        process_name_ = process_name;
+        capacity_ = std::max<size_t>(TRACE_CHUNK_EVENTS, env_int("VS_TRACE_EVENTS", 1 << 18));
+        int seconds = env_int("VS_TRACE_SECONDS", 60);
+        start_ns_ = now_ns();
+        end_ns_ = seconds > 0 ? start_ns_ + (uint64_t)seconds * 1000000000ull : UINT64_MAX;
+        enabled_.store(true, std::memory_order_release);
+        std::cout << "帧追踪已启用，" << (seconds > 0 ? std::to_string(seconds) + " 秒内" : "全程")
+                  << "的事件将在退出时写入 " << path_ << std::endl;
+    }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    static uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    void record(const char* name, char phase, uint64_t ts_ns, uint64_t dur_ns, int64_t id, int stream) {
+        if (!enabled() || ts_ns > end_ns_) return;
+        ThreadTraceBuffer* buffer = thread_buffer();
+        size_t index = buffer->count.load(std::memory_order_relaxed);
+        if (index == buffer->chunks.size() * TRACE_CHUNK_EVENTS && !grow(buffer)) {
+            buffer->dropped++;
+            return;
+        }
+        buffer->chunks[index / TRACE_CHUNK_EVENTS][index % TRACE_CHUNK_EVENTS] =
+            {name, ts_ns, dur_ns, id, current_tid(), (int16_t)stream, phase};
+        buffer->count.store(index + 1, std::memory_order_release);
+    }
+
+    // 在所有工作线程结束后调用
+    void write() {
+        if (!enabled()) return;
+        enabled_.store(false, std::memory_order_release);
+        std::ofstream out(path_, std::ios::trunc);
+        if (!out) {
+            std::cerr << "无法写入追踪文件 " << path_ << std::endl;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        const long pid = getpid();
+        size_t total = 0;
+        uint64_t dropped = 0;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"args\":{\"name\":\"" << process_name_ << "\"}}";
+        for (const auto& thread : threads_) {
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << thread.first
+                << ",\"args\":{\"name\":\"" << thread.second << "\"}}";
+        }
+        for (const auto& buffer : buffers_) {
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                const TraceEvent& event = buffer->chunks[i / TRACE_CHUNK_EVENTS][i % TRACE_CHUNK_EVENTS];
+                out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"stream" << event.stream
+                    << "\",\"ph\":\"" << event.phase
+                    << "\",\"pid\":" << pid << ",\"tid\":" << event.tid
+                    << ",\"ts\":" << event.ts_ns / 1000 << "." << (event.ts_ns % 1000) / 100;
+                if (event.phase == 'X') {
+                    out << ",\"dur\":" << event.dur_ns / 1000 << "." << (event.dur_ns % 1000) / 100;
+                } else if (event.phase == 'i') {
+                    out << ",\"s\":\"t\"";
+                }
+                if (event.phase == 'b' || event.phase == 'e') out << ",\"id\":" << event.id;
+                out << ",\"args\":{\"frame\":" << event.id << ",\"stream\":" << event.stream << "}}";
+            }
+            total += count;
+            dropped += buffer->dropped;
+        }
+        out << "\n]}\n";
+        std::cout << "帧追踪已写入 " << path_ << "：" << total << " 个事件，"
+                  << threads_.size() << " 个线程，" << buffers_.size() << " 个缓冲区";
+        if (dropped > 0) std::cout << "，事件总量用尽丢弃 " << dropped << " 个";
+        std::cout << std::endl;
+    }
+
+private:
+    // 线程退出时把缓冲区交还给追踪器
+    struct BufferLease {
+        ThreadTraceBuffer* buffer = nullptr;
+        ~BufferLease() {
+            if (buffer) FrameTracer::instance().release(buffer);
+        }
+    };
+
+    static int32_t current_tid() {
+        static thread_local int32_t tid = (int32_t)syscall(SYS_gettid);
+        return tid;
+    }
+
+    // 每个线程首次记录时取一个空闲缓冲区（没有时新建），之后的记录不加锁
+    ThreadTraceBuffer* thread_buffer() {
+        static thread_local BufferLease lease;
+        if (lease.buffer) return lease.buffer;
+
+        char name[32] = {0};
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.push_back(std::make_pair(current_tid(), std::string(name)));
+        if (!free_buffers_.empty()) {
+            lease.buffer = free_buffers_.back();
+            free_buffers_.pop_back();
+        } else {
+            buffers_.push_back(std::unique_ptr<ThreadTraceBuffer>(new ThreadTraceBuffer));
+            lease.buffer = buffers_.back().get();
+        }
+        return lease.buffer;
+    }
+
+    void release(ThreadTraceBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_buffers_.push_back(buffer);
+    }
+
+    // 从全进程的事件总量中再领一块
+    bool grow(ThreadTraceBuffer* buffer) {
+        if (reserved_events_.fetch_add(TRACE_CHUNK_EVENTS) + TRACE_CHUNK_EVENTS > capacity_) {
+            reserved_events_.fetch_sub(TRACE_CHUNK_EVENTS);
+            return false;
+        }
+        buffer->chunks.emplace_back(new TraceEvent[TRACE_CHUNK_EVENTS]);
+        return true;
+    }
+
+    std::atomic<bool> enabled_{false};
+    std::string path_;
+    std::string process_name_;
+    size_t capacity_ = 1 << 18;             // 全进程事件总量
+    std::atomic<size_t> reserved_events_{0};
+    uint64_t start_ns_ = 0;
+    uint64_t end_ns_ = UINT64_MAX;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadTraceBuffer>> buffers_;
+    std::vector<ThreadTraceBuffer*> free_buffers_;
+    std::vector<std::pair<int32_t, std::string>> threads_;  // 记录过事件的线程及其名称
+};
+
+inline bool trace_enabled() { return FrameTracer::instance().enabled(); }
+
+inline uint64_t trace_now() { return trace_enabled() ? FrameTracer::now_ns() : 0; }
+
+// 记录从 start_ns 到现在的线程内区间
+inline void trace_complete(const char* name, uint64_t start_ns, int64_t frame, int stream) {
+    if (!trace_enabled()) return;
+    FrameTracer::instance().record(name, 'X', start_ns, FrameTracer::now_ns() - start_ns, frame, stream);
+}
+
+// 跨线程的异步区间，以名称、流和帧标识配对；ts_ns为0表示当前时刻
+inline void trace_begin(const char* name, int64_t frame, int stream, uint64_t ts_ns = 0) {
+    if (!trace_enabled()) return;
+    FrameTracer::instance().record(name, 'b', ts_ns ? ts_ns : FrameTracer::now_ns(), 0, frame, stream);
+}
+
+inline void trace_end(const char* name, int64_t frame, int stream) {
+    if (!trace_enabled()) return;
+    FrameTracer::instance().record(name, 'e', FrameTracer::now_ns(), 0, frame, stream);
+}
+
+inline void trace_instant(const char* name, int64_t frame, int stream) {
+    if (!trace_enabled()) return;
+    FrameTracer::instance().record(name, 'i', FrameTracer::now_ns(), 0, frame, stream);
+}
+
+class TraceSpan {
+public:
+    TraceSpan(const char* name, int64_t frame, int stream)
+        : name_(name), frame_(frame), stream_(stream), start_(trace_now()) {}
+    ~TraceSpan() { trace_complete(name_, start_, frame_, stream_); }
+
+private:
+    const char* name_;
+    int64_t frame_;
+    int stream_;
+    uint64_t start_;
+};
+
+// 服务端帧率以分数表示：按帧序号打PTS与由PTS还原帧序号使用同一分数，两者互逆，
+// 非整数帧率（7.5、30000/1001、UVC报告的30.0003等）下也不会随帧数累积漂移
+struct FrameRate {
+    gint num = 0;   // 0表示未知
+    gint den = 1;
+};
+
+inline FrameRate frame_rate_from_fps(double fps) {
+    FrameRate rate;
+    gst_util_double_to_fraction(fps, &rate.num, &rate.den);
+    return rate;
+}
+
+inline GstClockTime frame_pts(guint64 frame, const FrameRate& rate) {
+    return gst_util_uint64_scale(frame, GST_SECOND * rate.den, rate.num);
+}
+
+// frame_pts的逆运算，PTS无效或帧率未知时返回-1
+inline int64_t frame_index(GstClockTime pts, const FrameRate& rate) {
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || rate.num <= 0) return -1;
+    return (int64_t)gst_util_uint64_scale_round(pts, rate.num, GST_SECOND * rate.den);
+}
+
+// 在pad上结束/开始以帧标识配对的异步区间。rtp_marker为true时，
+// 每帧只在最后一个RTP包（marker位）处记录；帧率已知时按打PTS的同一分数
+// 把PTS还原为帧序号，帧率未知（客户端）时直接以PTS作为帧标识
+struct TracePoint {
+    const char* end_name;
+    const char* begin_name;
+    bool rtp_marker;
+    FrameRate rate;
+    int stream;
+};
+
+inline int64_t trace_frame_id(GstBuffer* buffer, const FrameRate& rate) {
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) return -1;
+    return rate.num > 0 ? frame_index(pts, rate) : (int64_t)pts;
+}
+
+inline bool trace_rtp_marker(GstBuffer* buffer) {
+    guint8 header[2] = {0, 0};
+    return gst_buffer_extract(buffer, 0, header, 2) == 2 && (header[1] & 0x80);
+}
+
+inline gboolean trace_list_item(GstBuffer** buffer, guint, gpointer user_data) {
+    const TracePoint* point = static_cast<const TracePoint*>(user_data);
+    if (point->rtp_marker && !trace_rtp_marker(*buffer)) return TRUE;
+    int64_t frame = trace_frame_id(*buffer, point->rate);
+    if (point->end_name) trace_end(point->end_name, frame, point->stream);
+    if (point->begin_name) trace_begin(point->begin_name, frame, point->stream);
+    return TRUE;
+}
+
+inline GstPadProbeReturn trace_pad_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    if (!trace_enabled()) return GST_PAD_PROBE_OK;
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info), trace_list_item, user_data);
+    } else if (GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info)) {
+        trace_list_item(&buffer, 0, user_data);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+inline void trace_pad(GstElement* pipeline, const char* element_name, const char* pad_name,
+                      const TracePoint& point) {
+    GstElement* element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    if (!element) return;
+    GstPad* pad = gst_element_get_static_pad(element, pad_name);
+    if (pad) {
+        gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                          trace_pad_probe, new TracePoint(point),
+                          [](gpointer data) { delete static_cast<TracePoint*>(data); });
+        gst_object_unref(pad);
+    }
+    gst_object_unref(element);
+}
+
+#endif
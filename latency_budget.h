@@ -0,0 +1,207 @@
+/* 
+filename: latency_budget.h
+author: Linductor
+data: 2026/10/19
+*/
+#ifndef VIDEOSERVER_LATENCY_BUDGET_H
+#define VIDEOSERVER_LATENCY_BUDGET_H
+
+#include <gst/gst.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common.h"
+
+// ================== 延迟预算模块 ==================
+// 按目标端到端延迟为两端管道的每一级队列定容，队列满时丢弃最旧数据并逐级计数
+enum class LatencyMode {
+    Smooth,   // 每级保留少量缓冲，优先画面流畅
+    Lowest    // 每级只保留一帧，优先最低延迟
+};
+
+struct LatencyBudget {
+    bool enabled = false;
+    int target_ms = 200;
+    LatencyMode mode = LatencyMode::Smooth;
+};
+
+// 目标延迟在各级之间的分配比例，两端合计为1
+const double SHARE_CAPTURE = 0.10;  // 服务端 appsrc
+const double SHARE_ENCODE = 0.10;   // 服务端 videoconvert → 编码器
+const double SHARE_SEND = 0.10;     // 服务端 打包 → 发送
+const double SHARE_JITTER = 0.40;   // 客户端 rtpjitterbuffer
+const double SHARE_DECODE = 0.15;   // 客户端 解包 → 解码器
+const double SHARE_RENDER = 0.15;   // 客户端 解码 → 显示
+
+inline LatencyBudget load_latency_budget() {
+    LatencyBudget budget;
+    int target = env_int("VS_LATENCY_BUDGET_MS", 0);
+    if (target <= 0) return budget;
+    budget.enabled = true;
+    budget.target_ms = target;
+    const char* mode = getenv("VS_LATENCY_MODE");
+    if (mode && strcmp(mode, "lowest") == 0) budget.mode = LatencyMode::Lowest;
+    return budget;
+}
+
+// 某一级可容纳的帧数：最低延迟模式固定为1，流畅模式至少2
+inline int budget_buffers(const LatencyBudget& budget, double share, double frame_ms) {
+    if (budget.mode == LatencyMode::Lowest) return 1;
+    return std::max(2, (int)(budget.target_ms * share / frame_ms));
+}
+
+inline int budget_ms(const LatencyBudget& budget, double share) {
+    return std::max(1, (int)(budget.target_ms * share));
+}
+
+// 丢弃最旧数据的有界队列，按帧数或时长限定容量（另一项为0表示不限）
+inline std::string leaky_queue_desc(const std::string& name, int max_buffers, int max_time_ms) {
+    return "queue name=" + name + " leaky=downstream max-size-bytes=0"
+           " max-size-buffers=" + std::to_string(max_buffers) +
+           " max-size-time=" + std::to_string((guint64)max_time_ms * GST_MSECOND);
+}
+
+// 编码之后的数据帧间相互参考，中途丢弃会花屏到下一个关键帧：
+// 这里的队列只限容量、满时阻塞上游，丢帧统一交给编码前的队列
+inline std::string bounded_queue_desc(const std::string& name, int max_buffers, int max_time_ms) {
+    return "queue name=" + name + " max-size-bytes=0"
+           " max-size-buffers=" + std::to_string(max_buffers) +
+           " max-size-time=" + std::to_string((guint64)max_time_ms * GST_MSECOND);
+}
+
+inline bool has_property(GstElement* element, const char* name) {
+    return g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != nullptr;
+}
+
+// 逐级丢弃计数：丢弃数 = 进入数 - 流出数 - 当前排队数
+// pipeline为空时不关联元素，丢弃数全部由调用方通过count_drop上报（如jitterbuffer统计）
+class StageDropCounter {
+public:
+    StageDropCounter(GstElement* pipeline, const std::string& name) : name_(name) {
+        if (!pipeline) return;
+        element_ = gst_bin_get_by_name(GST_BIN(pipeline), name.c_str());
+        if (!element_) return;
+        GstPad* sink = gst_element_get_static_pad(element_, "sink");
+        if (sink) {
+            gst_pad_add_probe(sink, static_cast<GstPadProbeType>(
+                GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST), count_probe, &in_, nullptr);
+            gst_object_unref(sink);
+        }
+        GstPad* src = gst_element_get_static_pad(element_, "src");
+        if (src) {
+            gst_pad_add_probe(src, static_cast<GstPadProbeType>(
+                GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST), count_probe, &out_, nullptr);
+            gst_object_unref(src);
+        }
+        has_level_ = has_property(element_, "current-level-buffers");
+    }
+
+    ~StageDropCounter() {
+        if (element_) gst_object_unref(element_);
+    }
+
+    // 没有sink pad的元素（appsrc）由调用方记录进入数
+    void count_in(uint64_t n = 1) { in_ += n; }
+    // 调用方在元素之外主动丢弃的数据
+    void count_drop(uint64_t n = 1) { manual_drops_ += n; }
+
+    const std::string& name() const { return name_; }
+
+    uint64_t dropped() const {
+        guint64 level = 0;
+        if (has_level_) g_object_get(element_, "current-level-buffers", &level, nullptr);
+        uint64_t in = in_.load(), out = out_.load();
+        uint64_t leaked = in > out + level ? in - out - level : 0;
+        return leaked + manual_drops_.load();
+    }
+
+private:
+    static GstPadProbeReturn count_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        std::atomic<uint64_t>* counter = static_cast<std::atomic<uint64_t>*>(user_data);
+        if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+            *counter += gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+        } else {
+            *counter += 1;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    std::string name_;
+    GstElement* element_ = nullptr;
+    bool has_level_ = false;
+    std::atomic<uint64_t> in_{0};
+    std::atomic<uint64_t> out_{0};
+    std::atomic<uint64_t> manual_drops_{0};
+};
+
+class DropAccounting {
+public:
+    StageDropCounter* add(GstElement* pipeline, const std::string& name) {
+        stages_.push_back(std::unique_ptr<StageDropCounter>(new StageDropCounter(pipeline, name)));
+        return stages_.back().get();
+    }
+
+    bool empty() const { return stages_.empty(); }
+
+    std::string summary() const {
+        std::ostringstream out;
+        for (size_t i = 0; i < stages_.size(); ++i) {
+            out << (i ? "，" : "") << stages_[i]->name() << " " << stages_[i]->dropped();
+        }
+        return out.str();
+    }
+
+private:
+    std::vector<std::unique_ptr<StageDropCounter>> stages_;
+};
+
+// ================== 采集时间戳模块 ==================
+// 服务端在每帧最后一个RTP包上附加采集时刻（RFC 5285单字节头部扩展，内容为
+// RFC 6051的64位NTP格式墙上时间），客户端据此计算从采集到显示的端到端延迟。
+// 不认识该扩展的接收端会直接忽略。跨主机时两端需以NTP/PTP同步时钟，结果含残余偏差
+const guint8 CAPTURE_TIME_EXT_ID = 7;
+
+inline guint64 wallclock_ntp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((guint64)(ts.tv_sec + 2208988800u) << 32) |
+           (((guint64)ts.tv_nsec << 32) / 1000000000u);
+}
+
+// 两个NTP时刻之差（纳秒）
+inline gint64 ntp_diff_ns(guint64 later, guint64 earlier) {
+    return (gint64)((double)(gint64)(later - earlier) * 1e9 / 4294967296.0);
+}
+
+// buffer须可写
+inline bool rtp_write_capture_time(GstBuffer* buffer, guint64 ntp) {
+    guint8 data[8];
+    for (int i = 0; i < 8; ++i) data[i] = (guint8)(ntp >> (56 - 8 * i));
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READWRITE, &rtp)) return false;
+    bool ok = gst_rtp_buffer_add_extension_onebyte_header(&rtp, CAPTURE_TIME_EXT_ID, data, sizeof(data));
+    gst_rtp_buffer_unmap(&rtp);
+    return ok;
+}
+
+inline bool rtp_read_capture_time(GstBuffer* buffer, guint64& ntp) {
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) return false;
+    gpointer data = nullptr;
+    guint size = 0;
+    bool ok = gst_rtp_buffer_get_extension_onebyte_header(&rtp, CAPTURE_TIME_EXT_ID, 0, &data, &size) &&
+              size == 8;
+    if (ok) {
+        ntp = 0;
+        for (int i = 0; i < 8; ++i) ntp = (ntp << 8) | static_cast<const guint8*>(data)[i];
+    }
+    gst_rtp_buffer_unmap(&rtp);
+    return ok;
+}
+
+#endif // VIDEOSERVER_LATENCY_BUDGET_H
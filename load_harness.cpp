@@ -0,0 +1,445 @@
+/*
+filename: load_harness.cpp
+author: Linductor
+data: 2026/10/19
+*/
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <json/json.h>
+#include "common.h"
+
+// 控制面压测：在本机模拟大量客户端，完成摄像头列表/选择握手后按脚本应答心跳，
+// 随机地直接断开（RST）或停止应答并重连，同时采样服务端进程的线程数、fd数与RSS，
+// 用于发现连接处理的扩展瓶颈和长时间运行的资源泄漏。
+// 合成客户端选择空的摄像头列表，不会打开摄像头或启动编码。
+
+std::atomic<bool> exit_program{false};
+
+void signal_handler(int) {
+    exit_program = true;
+}
+
+// ================== 压测配置 ==================
+struct HarnessConfig {
+    std::string server_ip = "127.0.0.1";
+    int port = 5001;
+    int clients = 200;
+    int duration_s = 60;            // 0表示一直运行到Ctrl+C
+    int ramp_ms = 10;               // 相邻客户端的启动间隔
+    double lifetime_s = 20;         // 每次连接的平均存活时间（指数分布），0表示不主动断开
+    double silent_fraction = 0.5;   // 断开时以“停止应答”模拟故障的比例，其余直接RST
+    int reconnect_ms = 500;
+    int detect_timeout_s = 30;      // 停止应答后等待服务端断开的上限
+    std::vector<int> statuses = {200};  // 心跳应答脚本，各客户端错开起点循环使用
+    int report_s = 5;
+    int server_pid = 0;             // 0表示按进程名 server 自动查找
+    std::string csv;
+};
+
+void print_usage() {
+    std::cout << "用法: ./load_harness [选项]\n"
+              << "  --server IP           服务端地址 (127.0.0.1)\n"
+              << "  --port N              服务端心跳端口 (5001)\n"
+              << "  --clients N           合成客户端数量 (200)\n"
+              << "  --duration S          运行秒数，0表示直到Ctrl+C (60)\n"
+              << "  --ramp-ms N           客户端启动间隔 (10)\n"
+              << "  --lifetime S          平均连接存活秒数，0表示不断开 (20)\n"
+              << "  --silent-fraction F   以停止应答方式断开的比例 (0.5)\n"
+              << "  --reconnect-ms N      断开后重连等待 (500)\n"
+              << "  --statuses 200,300    心跳应答脚本 (200)\n"
+              << "  --report S            报告间隔秒数 (5)\n"
+              << "  --server-pid PID      采样的服务端进程 (自动查找)\n"
+              << "  --csv FILE            同时把每个报告周期写入CSV\n";
+}
+
+bool parse_args(int argc, char* argv[], HarnessConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        if (key == "--help" || key == "-h") return false;
+        if (i + 1 >= argc) {
+            std::cerr << "缺少参数值: " << key << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (key == "--server") cfg.server_ip = value;
+        else if (key == "--port") cfg.port = atoi(value.c_str());
+        else if (key == "--clients") cfg.clients = std::max(1, atoi(value.c_str()));
+        else if (key == "--duration") cfg.duration_s = std::max(0, atoi(value.c_str()));
+        else if (key == "--ramp-ms") cfg.ramp_ms = std::max(0, atoi(value.c_str()));
+        else if (key == "--lifetime") cfg.lifetime_s = std::max(0.0, atof(value.c_str()));
+        else if (key == "--silent-fraction") cfg.silent_fraction = atof(value.c_str());
+        else if (key == "--reconnect-ms") cfg.reconnect_ms = std::max(0, atoi(value.c_str()));
+        else if (key == "--report") cfg.report_s = std::max(1, atoi(value.c_str()));
+        else if (key == "--server-pid") cfg.server_pid = atoi(value.c_str());
+        else if (key == "--csv") cfg.csv = value;
+        else if (key == "--statuses") {
+            cfg.statuses.clear();
+            std::stringstream ss(value);
+            std::string item;
+            while (std::getline(ss, item, ',')) cfg.statuses.push_back(atoi(item.c_str()));
+            if (cfg.statuses.empty()) cfg.statuses.push_back(200);
+        } else {
+            std::cerr << "未知选项: " << key << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// ================== 统计模块 ==================
+// 延迟样本同时保留本周期与全程两份，分别用于周期报告和最终汇总
+struct LatencySamples {
+    std::mutex mutex;
+    std::vector<double> interval;
+    std::vector<double> total;
+
+    void add(double ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        interval.push_back(ms);
+        total.push_back(ms);
+    }
+
+    std::vector<double> take_interval() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<double> samples;
+        samples.swap(interval);
+        return samples;
+    }
+
+    std::vector<double> all() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total;
+    }
+};
+
+double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) return 0;
+    size_t index = std::min(samples.size() - 1, (size_t)(p / 100.0 * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+std::string describe(std::vector<double> samples) {
+    if (samples.empty()) return "无样本";
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(1);
+    double max = *std::max_element(samples.begin(), samples.end());
+    out << "p50 " << percentile(samples, 50) << " / p90 " << percentile(samples, 90)
+        << " / p99 " << percentile(samples, 99) << " / max " << max << " ms (n=" << samples.size() << ")";
+    return out.str();
+}
+
+struct HarnessStats {
+    std::atomic<int> active{0};                 // 已完成握手、正在应答心跳的客户端
+    std::atomic<uint64_t> connects{0};
+    std::atomic<uint64_t> connect_failures{0};  // connect() 失败
+    std::atomic<uint64_t> handshake_failures{0};// 未收到摄像头列表或选择发送失败
+    std::atomic<uint64_t> heartbeats{0};
+    std::atomic<uint64_t> resets{0};            // 客户端直接RST断开
+    std::atomic<uint64_t> silences{0};          // 客户端停止应答
+    std::atomic<uint64_t> undetected{0};        // 停止应答后服务端在上限内未断开
+    std::atomic<uint64_t> server_closed{0};     // 正常应答期间被服务端断开
+    LatencySamples connect_ms;                  // connect() 到收到摄像头列表
+    LatencySamples detect_ms;                   // 停止应答到服务端断开
+};
+
+// ================== 服务端进程采样 ==================
+struct ProcessSample {
+    bool valid = false;
+    int threads = 0;
+    int fds = 0;
+    long rss_kb = 0;
+};
+
+int find_server_pid() {
+    DIR* proc = opendir("/proc");
+    if (!proc) return 0;
+    int found = 0;
+    while (struct dirent* entry = readdir(proc)) {
+        int pid = atoi(entry->d_name);
+        if (pid <= 0) continue;
+        std::ifstream comm("/proc/" + std::string(entry->d_name) + "/comm");
+        std::string name;
+        if (std::getline(comm, name) && name == "server") {
+            found = pid;
+            break;
+        }
+    }
+    closedir(proc);
+    return found;
+}
+
+ProcessSample sample_process(int pid) {
+    ProcessSample sample;
+    if (pid <= 0) return sample;
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) sample.threads = atoi(line.c_str() + 8);
+        else if (line.compare(0, 6, "VmRSS:") == 0) sample.rss_kb = atol(line.c_str() + 6);
+    }
+    DIR* fd_dir = opendir(("/proc/" + std::to_string(pid) + "/fd").c_str());
+    if (fd_dir) {
+        while (struct dirent* entry = readdir(fd_dir)) {
+            if (entry->d_name[0] != '.') sample.fds++;
+        }
+        closedir(fd_dir);
+        sample.valid = sample.threads > 0;
+    }
+    return sample;
+}
+
+// ================== 合成客户端 ==================
+int connect_to_server(const HarnessConfig& cfg) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(cfg.port);
+    inet_pton(AF_INET, cfg.server_ip.c_str(), &addr.sin_addr);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+void set_recv_timeout(int sock, int ms) {
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+// 可被退出标志打断的等待
+void harness_sleep(int ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    while (!exit_program && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min(ms, 50)));
+    }
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+void run_synthetic_client(int id, const HarnessConfig& cfg, HarnessStats& stats) {
+    std::mt19937 rng(id * 7919 + (unsigned)time(nullptr));
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::exponential_distribution<double> lifetime(cfg.lifetime_s > 0 ? 1.0 / cfg.lifetime_s : 1.0);
+    size_t status_index = id;
+    char buffer[64];
+
+    while (!exit_program) {
+        // 握手：连接并收到摄像头列表的耗时即连接延迟
+        auto start = std::chrono::steady_clock::now();
+        int sock = connect_to_server(cfg);
+        if (sock < 0) {
+            stats.connect_failures++;
+            harness_sleep(cfg.reconnect_ms);
+            continue;
+        }
+        set_recv_timeout(sock, 5000);
+        Json::Value cam_list;
+        if (!recv_json_line(sock, cam_list)) {
+            stats.handshake_failures++;
+            close(sock);
+            harness_sleep(cfg.reconnect_ms);
+            continue;
+        }
+        stats.connect_ms.add(elapsed_ms(start));
+        stats.connects++;
+
+        Json::Value selection;
+        selection["streams"] = Json::Value(Json::arrayValue);  // 不占用摄像头
+        if (!send_json(sock, selection)) {
+            stats.handshake_failures++;
+            close(sock);
+            harness_sleep(cfg.reconnect_ms);
+            continue;
+        }
+
+        // 按脚本应答心跳，直到本次连接的存活时间结束
+        stats.active++;
+        auto deadline = cfg.lifetime_s > 0 ?
+            std::chrono::steady_clock::now() + std::chrono::milliseconds((int64_t)(lifetime(rng) * 1000)) :
+            std::chrono::steady_clock::time_point::max();
+        bool closed_by_server = false;
+        set_recv_timeout(sock, 200);
+        while (!exit_program && std::chrono::steady_clock::now() < deadline) {
+            int n = recv(sock, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                std::string status = std::to_string(cfg.statuses[status_index++ % cfg.statuses.size()]) + "\n";
+                if (send(sock, status.c_str(), status.size(), MSG_NOSIGNAL) <= 0) {
+                    closed_by_server = true;
+                    break;
+                }
+                stats.heartbeats++;
+            } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                closed_by_server = true;
+                break;
+            }
+        }
+        stats.active--;
+
+        if (closed_by_server) {
+            stats.server_closed++;
+        } else if (!exit_program && uniform(rng) < cfg.silent_fraction) {
+            // 停止应答但保持连接，测量服务端发现故障并断开所需时间
+            stats.silences++;
+            auto silent_start = std::chrono::steady_clock::now();
+            bool detected = false;
+            while (!exit_program && elapsed_ms(silent_start) < cfg.detect_timeout_s * 1000.0) {
+                int n = recv(sock, buffer, sizeof(buffer), 0);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    detected = true;
+                    break;
+                }
+            }
+            if (detected) {
+                stats.detect_ms.add(elapsed_ms(silent_start));
+            } else if (!exit_program) {
+                stats.undetected++;
+            }
+        } else if (!exit_program) {
+            // 模拟进程崩溃或网络中断：SO_LINGER为0时close直接发送RST
+            stats.resets++;
+            struct linger lg;
+            lg.l_onoff = 1;
+            lg.l_linger = 0;
+            setsockopt(sock, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        }
+        close(sock);
+        harness_sleep(cfg.reconnect_ms);
+    }
+}
+
+// ================== 报告模块 ==================
+void report(const HarnessConfig& cfg, HarnessStats& stats, int pid, int elapsed_s,
+            std::ofstream& csv) {
+    std::vector<double> connect = stats.connect_ms.take_interval();
+    std::vector<double> detect = stats.detect_ms.take_interval();
+    ProcessSample proc = sample_process(pid);
+
+    std::cout << "[" << elapsed_s << "s] 活跃 " << stats.active << "/" << cfg.clients
+              << "，连接 " << describe(connect)
+              << "\n        故障检测 " << describe(detect)
+              << "，失败 connect " << stats.connect_failures << " / 握手 " << stats.handshake_failures
+              << " / 被断开 " << stats.server_closed << " / 未检测 " << stats.undetected;
+    if (proc.valid) {
+        std::cout << "\n        服务端 线程 " << proc.threads << "，fd " << proc.fds
+                  << "，RSS " << proc.rss_kb << " KB";
+    }
+    std::cout << std::endl;
+
+    if (csv.is_open()) {
+        csv << elapsed_s << "," << stats.active << "," << stats.connects << ","
+            << percentile(connect, 50) << "," << percentile(connect, 99) << ","
+            << percentile(detect, 50) << "," << percentile(detect, 99) << ","
+            << stats.connect_failures << "," << stats.handshake_failures << ","
+            << stats.server_closed << "," << stats.undetected << ","
+            << proc.threads << "," << proc.fds << "," << proc.rss_kb << "\n";
+        csv.flush();
+    }
+}
+
+// ================== 主控制逻辑 ==================
+int main(int argc, char* argv[]) {
+    HarnessConfig cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        print_usage();
+        return 1;
+    }
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    // 每个合成客户端一个socket，按需提高fd上限
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int pid = cfg.server_pid > 0 ? cfg.server_pid : find_server_pid();
+    ProcessSample baseline = sample_process(pid);
+    if (!baseline.valid) {
+        std::cerr << "未找到服务端进程，不采样线程/fd/RSS（可用 --server-pid 指定）" << std::endl;
+    }
+
+    std::ofstream csv;
+    if (!cfg.csv.empty()) {
+        csv.open(cfg.csv);
+        csv << "elapsed_s,active,connects,connect_p50_ms,connect_p99_ms,detect_p50_ms,detect_p99_ms,"
+               "connect_failures,handshake_failures,server_closed,undetected,threads,fds,rss_kb\n";
+    }
+
+    std::cout << "压测 " << cfg.server_ip << ":" << cfg.port << "，" << cfg.clients << " 个客户端，"
+              << (cfg.duration_s > 0 ? std::to_string(cfg.duration_s) + " 秒" : "直到Ctrl+C") << std::endl;
+
+    HarnessStats stats;
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    auto next_report = start + std::chrono::seconds(cfg.report_s);
+    int started = 0;
+    while (!exit_program) {
+        auto now = std::chrono::steady_clock::now();
+        int elapsed = (int)std::chrono::duration_cast<std::chrono::seconds>(now - start).count();
+        if (cfg.duration_s > 0 && elapsed >= cfg.duration_s) break;
+
+        // 逐个启动客户端，避免瞬间涌入掩盖真实的连接延迟
+        if (started < cfg.clients) {
+            clients.emplace_back(run_synthetic_client, started, std::cref(cfg), std::ref(stats));
+            started++;
+        }
+        if (now >= next_report) {
+            report(cfg, stats, pid, elapsed, csv);
+            next_report += std::chrono::seconds(cfg.report_s);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(started < cfg.clients ? cfg.ramp_ms : 50));
+    }
+
+    exit_program = true;
+    for (auto& client : clients) client.join();
+
+    // 汇总：全程延迟分布，以及服务端资源相对压测开始时的增长
+    std::cout << "\n===== 汇总 =====" << std::endl;
+    std::cout << "连接 " << stats.connects << " 次，" << describe(stats.connect_ms.all()) << std::endl;
+    std::cout << "故障检测 " << describe(stats.detect_ms.all()) << "，RST断开 " << stats.resets
+              << " 次，停止应答 " << stats.silences << " 次，未检测 " << stats.undetected << " 次" << std::endl;
+    std::cout << "失败 connect " << stats.connect_failures << " / 握手 " << stats.handshake_failures
+              << " / 被断开 " << stats.server_closed << "，心跳应答 " << stats.heartbeats << " 次" << std::endl;
+
+    // 等服务端回收断开的会话后再取最终样本
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    ProcessSample final_sample = sample_process(pid);
+    if (baseline.valid && final_sample.valid) {
+        std::cout << "服务端（客户端全部断开5秒后 / 压测前）：线程 " << final_sample.threads << " / " << baseline.threads
+                  << "，fd " << final_sample.fds << " / " << baseline.fds
+                  << "，RSS " << final_sample.rss_kb << " / " << baseline.rss_kb << " KB"
+                  << std::endl;
+        if (final_sample.threads > baseline.threads || final_sample.fds > baseline.fds) {
+            std::cout << "警告: 客户端全部断开后线程或fd未回落到压测前水平，可能存在泄漏" << std::endl;
+        }
+    }
+    return 0;
+}
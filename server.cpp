@@ -6,6 +6,8 @@ data: 2025/05/03
 #include <opencv2/opencv.hpp>
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -21,38 +23,115 @@ data: 2025/05/03
 #include <ifaddrs.h>
 #include <linux/if_packet.h>
 #include <net/if.h>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <set>
+#include <map>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <ctime>
+#include <sys/resource.h>
+#include <cmath>
+#include <algorithm>
+#include "common.h"
+#include "latency_budget.h"
+#include "shm_ring.h"
+#include "frame_trace.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 
 // 全局状态管理
-std::atomic<bool> is_connected{false};
-std::atomic<bool> heartbeat_timeout{false};
 std::atomic<bool> exit_program{false};
-std::mutex heartbeat_mutex;
-int heartbeat_socket = -1;
-static int listen_sock = -1;
+static volatile sig_atomic_t listen_sock = -1;  // 信号处理函数中读取
 
-// 分辨率配置和摄像头列表
+// 分辨率配置和视频端口（第k路视频流发往 VIDEO_PORT + 2k）
 const std::vector<std::pair<int, int>> RES_LEVELS = {{1280,720}, {640,360}, {320,180}};
-std::atomic<int> current_res_level{0};
-std::vector<int> available_cams;
+const int VIDEO_PORT = 5000;
 
-// 全局新增信号处理
+// ================== 客户端会话模块 ==================
+// 每个选中的摄像头由独立的采集/编码工作线程推流
+struct StreamWorker {
+    int camera_index = -1;
+    int video_port = VIDEO_PORT;
+    int core = -1;                                 // 绑定的CPU核，-1表示不绑定
+    std::string shm_name;                          // 非空表示同机客户端，经共享内存传输原始帧
+    std::atomic<int> res_level{0};                 // 按客户端对本路的拥塞反馈独立调整
+    int last_level = 0;                            // 仅心跳线程访问
+    std::thread thread;
+    std::atomic<bool> keyframe_requested{false};  // 客户端解码前丢包/丢帧后请求尽快插入关键帧
+    std::atomic<bool> streaming_clock_valid{false};
+    clockid_t streaming_clock;                     // appsrc推流线程的CPU时钟
+};
+
+// 每个客户端一个会话，拥有独立的心跳连接和推流工作线程
+struct ClientSession {
+    int socket = -1;
+    std::string client_ip;
+    std::string codec;                             // 客户端选择的编码格式，空表示默认H264
+    std::atomic<bool> connected{true};
+    std::vector<std::unique_ptr<StreamWorker>> workers;
+    std::thread thread;
+    std::atomic<bool> finished{false};
+};
+
+// 全局新增信号处理：只置退出标志并唤醒阻塞在accept上的主线程，
+// socket的关闭与其余清理都由主线程完成
 void signal_handler(int signum) {
-    std::cout << "\n收到终止信号，清理资源..." << std::endl;
     exit_program = true;
-    close(listen_sock); 
+    if (listen_sock != -1) shutdown(listen_sock, SHUT_RDWR);
 }
 
 // 状态处理函数
-void handle_status(int code) {
-    static int last_level = 0;
+void handle_status(StreamWorker* worker, int code) {
+    int last_level = worker->last_level;
     int new_level = code == 300 ? 
         std::min(last_level+1, (int)RES_LEVELS.size()-1) : 
         std::max(last_level-1, 0);
     
     if (new_level != last_level) {
-        current_res_level = new_level;
-        last_level = new_level;
+        worker->res_level = new_level;
+        worker->last_level = new_level;
+    }
+}
+
+// 心跳应答每行为"<汇总状态码>[ <摄像头>:<状态码>]...[ k<摄像头>]..."：
+// 按摄像头给出的状态码只作用于该路，未列出的路沿用汇总状态码；
+// k项表示该路需要关键帧恢复解码。旧客户端只回状态码且不带换行，同样按一行处理
+void handle_heartbeat_reply(ClientSession* session, const char* reply) {
+    std::istringstream lines(reply);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream tokens(line);
+        std::string token;
+        if (!(tokens >> token)) continue;
+        const int aggregate = atoi(token.c_str());
+        std::map<int, int> codes;
+        while (tokens >> token) {
+            if (token.size() >= 2 && token[0] == 'k') {
+                int camera = atoi(token.c_str() + 1);
+                for (auto& worker : session->workers) {
+                    if (worker->camera_index == camera) worker->keyframe_requested = true;
+                }
+                continue;
+            }
+            size_t colon = token.find(':');
+            if (colon != std::string::npos) {
+                codes[atoi(token.substr(0, colon).c_str())] = atoi(token.c_str() + colon + 1);
+            }
+        }
+        for (auto& worker : session->workers) {
+            auto it = codes.find(worker->camera_index);
+            handle_status(worker.get(), it != codes.end() ? it->second : aggregate);
+        }
     }
 }
 
@@ -141,21 +220,15 @@ void broadcast_server_presence() {
 }
 
 // ================== 心跳检测模块 ==================
-void heartbeat_listener() {
-    std::unique_lock<std::mutex> lock(heartbeat_mutex, std::defer_lock);
+void heartbeat_listener(ClientSession* session) {
+    const int heartbeat_socket = session->socket;
     char request[] = "PING";
-    char buffer[16];
+    char buffer[256];
     time_t last_heartbeat = time(nullptr);
 
-    while (!exit_program && is_connected) {
-        lock.lock();
-        if (heartbeat_socket == -1) {
-            lock.unlock();
-            break;
-        }
-
-        // 发送心跳请求
-        if (send(heartbeat_socket, request, sizeof(request), 0) <= 0) {
+    while (!exit_program && session->connected) {
+        // 发送心跳请求（对端断开时不触发SIGPIPE，避免影响其他会话）
+        if (send(heartbeat_socket, request, sizeof(request), MSG_NOSIGNAL) <= 0) {
             last_heartbeat = 0; // 立即触发超时检测
         } else {
             // 设置接收超时为1秒
@@ -165,25 +238,24 @@ void heartbeat_listener() {
             setsockopt(heartbeat_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
             // 等待响应
-            int n = recv(heartbeat_socket, buffer, sizeof(buffer), 0);
+            int n = recv(heartbeat_socket, buffer, sizeof(buffer) - 1, 0);
             if (n > 0) {
+                buffer[n] = '\0';
                 last_heartbeat = time(nullptr);
-                handle_status(atoi(buffer));
+                handle_heartbeat_reply(session, buffer);
             } else if (time(nullptr) - last_heartbeat > 3) {
                 std::cerr << "心跳丢失，连接中断!" << std::endl;
-                heartbeat_timeout = true;
-                lock.unlock();
                 break;
             }
         }
         // 接收响应（增加错误检测）
-        int n = recv(heartbeat_socket, buffer, sizeof(buffer), 0);
+        int n = recv(heartbeat_socket, buffer, sizeof(buffer) - 1, 0);
         if (n > 0) {
+            buffer[n] = '\0';
             last_heartbeat = time(nullptr);
-            handle_status(atoi(buffer));
+            handle_heartbeat_reply(session, buffer);
         } else if (n == 0) {
             std::cerr << "客户端正常关闭连接" << std::endl;
-            is_connected = false;
             break;
         } else {
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -197,68 +269,1225 @@ void heartbeat_listener() {
             std::cerr << "心跳超时，连接中断!" << std::endl;
             break;
         }
-        lock.unlock();
         std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
 
-    if (heartbeat_timeout) {
-        close(heartbeat_socket);
-        is_connected = false;
-        heartbeat_timeout = false;
+    // 心跳结束即会话结束，通知该会话的所有推流线程退出
+    session->connected = false;
+    shutdown(heartbeat_socket, SHUT_RDWR);
+    close(heartbeat_socket);
+}
+
+// ================== 编码器后端模块 ==================
+// 可选的软件编码器，presets按画质由高到低排列，均为低延迟参数
+struct EncoderBackend {
+    std::string element;               // GStreamer编码元素
+    std::string codec;                 // 通知客户端的编码格式
+    std::string payloader;             // RTP打包元素及参数
+    std::vector<std::string> presets;  // 候选参数，画质由高到低
+    int efficiency_rank;               // 同等画质下的码率效率，数值越小越好
+};
+
+const std::vector<EncoderBackend> ENCODER_BACKENDS = {
+    {"x265enc", "H265", "rtph265pay config-interval=1 pt=96",
+     {"tune=zerolatency speed-preset=veryfast",
+      "tune=zerolatency speed-preset=superfast",
+      "tune=zerolatency speed-preset=ultrafast"}, 0},
+    {"x264enc", "H264", "rtph264pay config-interval=1 pt=96",
+     {"tune=zerolatency speed-preset=veryfast",
+      "tune=zerolatency speed-preset=superfast",
+      "tune=zerolatency speed-preset=ultrafast"}, 1},
+    {"vp8enc", "VP8", "rtpvp8pay pt=96",
+     {"deadline=1 cpu-used=4 end-usage=cbr lag-in-frames=0 error-resilient=default keyframe-max-dist=60",
+      "deadline=1 cpu-used=8 end-usage=cbr lag-in-frames=0 error-resilient=default keyframe-max-dist=60",
+      "deadline=1 cpu-used=16 end-usage=cbr lag-in-frames=0 error-resilient=default keyframe-max-dist=60"}, 2},
+    {"openh264enc", "H264", "rtph264pay config-interval=1 pt=96",
+     {"complexity=high rate-control=bitrate usage-type=camera",
+      "complexity=medium rate-control=bitrate usage-type=camera",
+      "complexity=low rate-control=bitrate usage-type=camera"}, 3},
+};
+
+struct EncoderSelection {
+    const EncoderBackend* backend = &ENCODER_BACKENDS[1];
+    std::string preset = "tune=zerolatency speed-preset=ultrafast";
+};
+// 每种编码格式一个选择，按码率效率排列，启动时确定，之后只读。
+// 客户端在选择消息中声明可解码的格式前，一律使用H264
+std::vector<EncoderSelection> encoder_choices;
+const std::string DEFAULT_CODEC = "H264";
+
+const EncoderBackend* find_encoder_backend(const std::string& element) {
+    for (const auto& backend : ENCODER_BACKENDS) {
+        if (backend.element == element) return &backend;
     }
-    if (heartbeat_socket != -1) {
-        shutdown(heartbeat_socket, SHUT_RDWR);
-        close(heartbeat_socket);
-        heartbeat_socket = -1;
+    return nullptr;
+}
+
+// 未做校准或校准全部失败时为 x264enc ultrafast；强制指定其他格式的编码器时为该编码器
+const EncoderSelection& default_encoder() {
+    static const EncoderSelection fallback;
+    for (const auto& choice : encoder_choices) {
+        if (choice.backend->codec == DEFAULT_CODEC) return choice;
+    }
+    return encoder_choices.empty() ? fallback : encoder_choices.front();
+}
+
+const EncoderSelection& encoder_for_codec(const std::string& codec) {
+    for (const auto& choice : encoder_choices) {
+        if (choice.backend->codec == codec) return choice;
+    }
+    return default_encoder();
+}
+
+bool encoder_available(const EncoderBackend& backend) {
+    GstElementFactory* enc = gst_element_factory_find(backend.element.c_str());
+    std::string pay_name = backend.payloader.substr(0, backend.payloader.find(' '));
+    GstElementFactory* pay = gst_element_factory_find(pay_name.c_str());
+    bool ok = enc && pay;
+    if (enc) gst_object_unref(enc);
+    if (pay) gst_object_unref(pay);
+    return ok;
+}
+
+// 发送管道中的编码段，统一命名为encoder供探针使用
+std::string encoder_pipeline_desc(const EncoderSelection& encoder) {
+    return encoder.backend->element + " name=encoder " + encoder.preset +
+           " ! " + encoder.backend->payloader + " name=pay";
+}
+
+bool pin_current_thread(int core);
+
+// 推流线程首次处理数据（stream-start事件）时绑核，编码器随后创建的内部线程继承亲和性
+static GstPadProbeReturn pin_streaming_thread(GstPad*, GstPadProbeInfo*, gpointer user_data) {
+    pin_current_thread(GPOINTER_TO_INT(user_data));
+    return GST_PAD_PROBE_REMOVE;
+}
+
+// 统计fakesink收到首帧到末帧的间隔，排除编码器初始化开销
+struct CalibrationProbe {
+    int frames = 0;
+    gint64 first_us = 0;
+    gint64 last_us = 0;
+};
+
+static GstPadProbeReturn calibration_probe(GstPad*, GstPadProbeInfo*, gpointer user_data) {
+    CalibrationProbe* probe = static_cast<CalibrationProbe*>(user_data);
+    gint64 now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (probe->frames++ == 0) probe->first_us = now;
+    probe->last_us = now;
+    return GST_PAD_PROBE_OK;
+}
+
+// 用合成画面测量单帧编码耗时（毫秒），失败返回负数。core>=0时编码线程绑定到该核，
+// 与推流工作线程的运行条件一致
+double measure_encoder(const EncoderBackend& backend, const std::string& preset,
+                       int width, int height, int frames, int core) {
+    std::string desc =
+        "videotestsrc num-buffers=" + std::to_string(frames) +
+        " pattern=smpte horizontal-speed=8 ! "
+        "video/x-raw,format=I420,width=" + std::to_string(width) +
+        ",height=" + std::to_string(height) + ",framerate=30/1 ! " +
+        backend.element + " name=encoder " + preset + " ! fakesink name=sink sync=false";
+
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(desc.c_str(), &error);
+    if (!pipeline || error) {
+        if (error) g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        return -1;
+    }
+
+    if (core >= 0) {
+        GstElement* encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+        GstPad* encoder_sink = gst_element_get_static_pad(encoder, "sink");
+        gst_pad_add_probe(encoder_sink, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM,
+                          pin_streaming_thread, GINT_TO_POINTER(core), nullptr);
+        gst_object_unref(encoder_sink);
+        gst_object_unref(encoder);
+    }
+
+    CalibrationProbe probe;
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, calibration_probe, &probe, nullptr);
+    gst_object_unref(sink_pad);
+    gst_object_unref(sink);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstBus* bus = gst_element_get_bus(pipeline);
+    GstMessage* msg = gst_bus_timed_pop_filtered(bus, 10 * GST_SECOND,
+        static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    bool ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg) gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    if (!ok || probe.frames < 2) return -1;
+    return (probe.last_us - probe.first_us) / 1000.0 / (probe.frames - 1);
+}
+
+// 主机指纹：CPU型号、核数、GStreamer版本及可用编码器，变化后缓存失效
+std::string host_fingerprint() {
+    std::string cpu_model = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            size_t pos = line.find(':');
+            if (pos != std::string::npos) cpu_model = line.substr(pos + 2);
+            break;
+        }
+    }
+    gchar* gst_ver = gst_version_string();
+    std::string fingerprint = cpu_model + "|" +
+        std::to_string(std::thread::hardware_concurrency()) + "|" + gst_ver;
+    g_free(gst_ver);
+    for (const auto& backend : ENCODER_BACKENDS) {
+        if (encoder_available(backend)) fingerprint += "|" + backend.element;
+    }
+    return fingerprint;
+}
+
+std::string calibration_cache_path() {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    std::string dir = (xdg && *xdg) ? xdg : std::string(home ? home : "/tmp") + "/.cache";
+    mkdir(dir.c_str(), 0755);
+    dir += "/videoserver";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/encoder_calibration.json";
+}
+
+// 影响校准结果的全部条件，任一项与缓存不同即重新校准
+struct CalibrationKey {
+    std::string fingerprint;
+    std::string forced;      // VS_ENCODER
+    double budget_ms;
+    int frames;
+    int core;                // 校准时绑定的CPU核，-1表示不绑定
+};
+
+bool load_calibration_cache(const std::string& path, const CalibrationKey& key) {
+    std::ifstream in(path);
+    Json::Value cache;
+    if (!in || !Json::Reader().parse(in, cache)) return false;
+    if (cache["fingerprint"].asString() != key.fingerprint ||
+        cache["forced"].asString() != key.forced ||
+        std::fabs(cache["budget_ms"].asDouble() - key.budget_ms) > 1e-6 ||
+        cache["calibrate_frames"].asInt() != key.frames ||
+        cache.get("core", -1).asInt() != key.core ||
+        !cache["encoders"].isArray()) {
+        return false;
+    }
+
+    // 缓存中的参数会拼进管道描述，只接受后端自身列出的候选参数
+    std::vector<EncoderSelection> choices;
+    for (const auto& entry : cache["encoders"]) {
+        const EncoderBackend* backend = find_encoder_backend(entry["backend"].asString());
+        if (!backend) return false;
+        std::string preset = entry["preset"].asString();
+        if (std::find(backend->presets.begin(), backend->presets.end(), preset) == backend->presets.end()) {
+            return false;
+        }
+        EncoderSelection choice;
+        choice.backend = backend;
+        choice.preset = preset;
+        choices.push_back(choice);
+    }
+    if (choices.empty()) return false;
+    encoder_choices = choices;
+    return true;
+}
+
+void print_encoder_choices(const char* title) {
+    std::cout << title;
+    for (size_t i = 0; i < encoder_choices.size(); ++i) {
+        std::cout << (i ? "；" : "") << encoder_choices[i].backend->codec << " → "
+                  << encoder_choices[i].backend->element << " " << encoder_choices[i].preset;
+    }
+    std::cout << std::endl;
+}
+
+// 在每个RES_LEVELS尺寸上编码合成帧，为每种编码格式选取满足帧预算且效率最好的后端与参数。
+// core>=0（配置了VS_WORKER_CORES）时在该核上校准，与推流工作线程的单核运行条件一致
+void calibrate_encoder(int core) {
+    std::string forced = getenv("VS_ENCODER") ? getenv("VS_ENCODER") : "";
+    if (!forced.empty() && !find_encoder_backend(forced)) {
+        std::cerr << "未知编码器 " << forced << "，忽略VS_ENCODER" << std::endl;
+        forced.clear();
+    }
+    if (!env_flag("VS_ENCODER_CALIBRATE", true)) {
+        if (!forced.empty()) {
+            EncoderSelection choice;
+            choice.backend = find_encoder_backend(forced);
+            choice.preset = choice.backend->presets.back();
+            encoder_choices.push_back(choice);
+        }
+        return;
+    }
+
+    std::string path = calibration_cache_path();
+    CalibrationKey key;
+    key.fingerprint = host_fingerprint();
+    key.forced = forced;
+    key.frames = env_int("VS_CALIBRATE_FRAMES", 30);
+    key.budget_ms = 1000.0 / 30 * env_double("VS_ENCODER_BUDGET", 0.5);
+    key.core = core;
+    if (!env_flag("VS_RECALIBRATE", false) && load_calibration_cache(path, key)) {
+        print_encoder_choices("使用缓存的编码器校准结果: ");
+        return;
+    }
+
+    std::cout << "开始编码器校准，单帧预算 " << key.budget_ms << "ms";
+    if (key.core >= 0) std::cout << "，绑定CPU核" << key.core;
+    std::cout << std::endl;
+
+    // ENCODER_BACKENDS按效率排列，每种格式取第一个满足预算的后端
+    Json::Value encoders(Json::arrayValue);
+    for (const auto& backend : ENCODER_BACKENDS) {
+        if (!forced.empty() && backend.element != forced) continue;
+        bool codec_done = false;
+        for (const auto& choice : encoder_choices) {
+            if (choice.backend->codec == backend.codec) codec_done = true;
+        }
+        if (codec_done || !encoder_available(backend)) continue;
+
+        for (const auto& preset : backend.presets) {
+            Json::Value levels(Json::arrayValue);
+            bool within_budget = true;
+            for (const auto& res : RES_LEVELS) {
+                double ms = measure_encoder(backend, preset, res.first, res.second, key.frames, key.core);
+                std::cout << "  " << backend.element << " [" << preset << "] "
+                          << res.first << "x" << res.second << ": "
+                          << (ms < 0 ? std::string("失败") : std::to_string(ms) + "ms") << std::endl;
+                Json::Value level;
+                level["width"] = res.first;
+                level["height"] = res.second;
+                level["ms_per_frame"] = ms;
+                levels.append(level);
+                if (ms < 0 || ms > key.budget_ms) {
+                    within_budget = false;
+                    break;
+                }
+            }
+            if (within_budget) {
+                EncoderSelection choice;
+                choice.backend = &backend;
+                choice.preset = preset;
+                encoder_choices.push_back(choice);
+                Json::Value entry;
+                entry["backend"] = backend.element;
+                entry["preset"] = preset;
+                entry["levels"] = levels;
+                encoders.append(entry);
+                break;
+            }
+        }
+    }
+
+    if (encoder_choices.empty()) {
+        std::cerr << "没有编码器满足帧预算，使用默认 x264enc ultrafast" << std::endl;
+        return;
+    }
+    if (forced.empty() && default_encoder().backend->codec != DEFAULT_CODEC) {
+        // 未声明编码格式的客户端只能解码H264，即使超出预算也保留一个H264编码器
+        std::cerr << "没有H264编码器满足帧预算，H264客户端使用 x264enc ultrafast" << std::endl;
+        EncoderSelection fallback;
+        encoder_choices.push_back(fallback);
+        Json::Value entry;
+        entry["backend"] = fallback.backend->element;
+        entry["preset"] = fallback.preset;
+        encoders.append(entry);
+    }
+    print_encoder_choices("编码器校准完成: ");
+
+    Json::Value cache;
+    cache["fingerprint"] = key.fingerprint;
+    cache["forced"] = forced;
+    cache["budget_ms"] = key.budget_ms;
+    cache["calibrate_frames"] = key.frames;
+    cache["core"] = key.core;
+    cache["encoders"] = encoders;
+    std::ofstream out(path);
+    if (out) {
+        out << Json::StyledWriter().write(cache);
+    } else {
+        std::cerr << "无法写入校准缓存 " << path << std::endl;
     }
 }
 
 // ================== 摄像头管理模块 ==================
-std::vector<int> get_available_cameras(int max_check = 5) { // 减少检测范围
+// 每个摄像头的JPEG缩略图，供客户端在不开视频流的情况下预览
+struct Thumbnail {
+    std::vector<unsigned char> jpeg;
+    int width = 0;
+    int height = 0;
+    std::chrono::steady_clock::time_point updated;
+};
+
+// 摄像头登记表：记录最近一次探测结果及正在推流占用的摄像头
+struct CameraRegistry {
+    std::mutex mutex;
+    std::mutex probe_mutex;     // 串行化设备探测，避免多个会话同时打开设备
+    std::vector<int> available;
+    std::set<int> in_use;
+    std::map<int, Thumbnail> thumbnails;
+    std::map<int, cv::Mat> pending_thumbnails;   // 已缩小、待压缩的帧
+    std::map<int, std::chrono::steady_clock::time_point> last_thumbnail_offer;
+    std::condition_variable thumbnail_cv;
+};
+CameraRegistry camera_registry;
+
+// ================== 缩略图模块 ==================
+// 缩略图取自探测时读到的帧和推流中已采集的帧，采集线程只做缩小，
+// JPEG压缩在后台线程中完成；空闲摄像头可按较低频率重新探测刷新
+struct ThumbnailConfig {
+    bool enabled = true;
+    int width = 160;
+    int quality = 70;
+    int interval_ms = 2000;   // 推流中摄像头的刷新间隔
+    int probe_s = 0;          // 空闲摄像头的重新探测间隔，0表示只在客户端连接时探测
+};
+
+ThumbnailConfig load_thumbnail_config() {
+    ThumbnailConfig cfg;
+    cfg.enabled = env_flag("VS_THUMBNAILS", cfg.enabled);
+    cfg.width = std::max(16, env_int("VS_THUMB_WIDTH", cfg.width));
+    cfg.quality = std::min(100, std::max(1, env_int("VS_THUMB_QUALITY", cfg.quality)));
+    cfg.interval_ms = std::max(100, env_int("VS_THUMB_INTERVAL_MS", cfg.interval_ms));
+    cfg.probe_s = std::max(0, env_int("VS_THUMB_PROBE_S", cfg.probe_s));
+    return cfg;
+}
+ThumbnailConfig thumbnail_config;
+
+// 在采集线程中调用，未到刷新间隔时直接返回
+void offer_thumbnail(int index, const cv::Mat& frame, bool force = false) {
+    if (!thumbnail_config.enabled || frame.empty() || frame.cols <= 0) return;
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(camera_registry.mutex);
+        auto it = camera_registry.last_thumbnail_offer.find(index);
+        if (!force && it != camera_registry.last_thumbnail_offer.end() &&
+            now - it->second < std::chrono::milliseconds(thumbnail_config.interval_ms)) {
+            return;
+        }
+        camera_registry.last_thumbnail_offer[index] = now;
+    }
+    int width = std::min(thumbnail_config.width, frame.cols);
+    int height = std::max(1, frame.rows * width / frame.cols);
+    cv::Mat small;
+    cv::resize(frame, small, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+    {
+        std::lock_guard<std::mutex> lock(camera_registry.mutex);
+        camera_registry.pending_thumbnails[index] = small;
+    }
+    camera_registry.thumbnail_cv.notify_one();
+}
+
+std::vector<int> get_available_cameras(int max_check = 5);
+
+// 压缩所有待处理的缩略图
+void encode_pending_thumbnails() {
+    std::map<int, cv::Mat> pending;
+    {
+        std::lock_guard<std::mutex> lock(camera_registry.mutex);
+        pending.swap(camera_registry.pending_thumbnails);
+    }
+    for (auto& item : pending) {
+        Thumbnail thumbnail;
+        std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, thumbnail_config.quality};
+        if (!cv::imencode(".jpg", item.second, thumbnail.jpeg, params)) continue;
+        thumbnail.width = item.second.cols;
+        thumbnail.height = item.second.rows;
+        thumbnail.updated = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(camera_registry.mutex);
+        camera_registry.thumbnails[item.first] = std::move(thumbnail);
+    }
+}
+
+void thumbnail_worker() {
+    auto last_probe = std::chrono::steady_clock::now();
+    while (!exit_program) {
+        {
+            std::unique_lock<std::mutex> lock(camera_registry.mutex);
+            camera_registry.thumbnail_cv.wait_for(lock, std::chrono::seconds(1), [] {
+                return !camera_registry.pending_thumbnails.empty() || exit_program;
+            });
+        }
+        encode_pending_thumbnails();
+
+        auto now = std::chrono::steady_clock::now();
+        if (thumbnail_config.probe_s > 0 && !exit_program &&
+            now - last_probe >= std::chrono::seconds(thumbnail_config.probe_s)) {
+            get_available_cameras();
+            last_probe = now;
+        }
+    }
+}
+
+// 缩略图消息：JPEG以base64放在JSON中，尚未生成缩略图的摄像头不列出
+Json::Value thumbnails_json(const std::vector<int>& cameras) {
+    Json::Value message;
+    message["type"] = "thumbnails";
+    message["thumbnails"] = Json::Value(Json::arrayValue);
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(camera_registry.mutex);
+    for (int index : cameras) {
+        auto it = camera_registry.thumbnails.find(index);
+        if (it == camera_registry.thumbnails.end()) continue;
+        const Thumbnail& thumbnail = it->second;
+        gchar* encoded = g_base64_encode(thumbnail.jpeg.data(), thumbnail.jpeg.size());
+        Json::Value entry;
+        entry["camera_index"] = index;
+        entry["width"] = thumbnail.width;
+        entry["height"] = thumbnail.height;
+        entry["age_ms"] = (Json::Int64)std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - thumbnail.updated).count();
+        entry["jpeg"] = encoded;
+        g_free(encoded);
+        message["thumbnails"].append(entry);
+    }
+    return message;
+}
+
+// ================== 摄像头探测模块 ==================
+
+bool camera_in_use(int index) {
+    std::lock_guard<std::mutex> lock(camera_registry.mutex);
+    return camera_registry.in_use.count(index) > 0;
+}
+
+std::vector<int> get_available_cameras(int max_check) { // 减少检测范围
+    std::lock_guard<std::mutex> probe_lock(camera_registry.probe_mutex);
     std::vector<int> cameras;
     for (int i = 0; i < max_check; ++i) {
+        // 推流中的摄像头无法再次打开，直接视为可用
+        if (camera_in_use(i)) {
+            cameras.push_back(i);
+            continue;
+        }
         cv::VideoCapture cap(i, cv::CAP_V4L2); // 明确使用V4L2后端
         if (cap.isOpened()) {
             // 验证摄像头是否真正可用
             cv::Mat test_frame;
             if (cap.read(test_frame)) {
                 cameras.push_back(i);
+                offer_thumbnail(i, test_frame, true);
                 std::cout << "发现有效摄像头: /dev/video" << i << std::endl;
             }
             cap.release();
         }
     }
+    std::lock_guard<std::mutex> lock(camera_registry.mutex);
+    camera_registry.available = cameras;
     return cameras;
 }
 
-bool send_camera_list(int socket) {  // 修改返回类型为bool
+// 占用摄像头供推流使用，不可用或已被其他会话占用时返回false
+bool acquire_camera(int index) {
+    std::lock_guard<std::mutex> lock(camera_registry.mutex);
+    const std::vector<int>& available = camera_registry.available;
+    if (std::find(available.begin(), available.end(), index) == available.end() ||
+        camera_registry.in_use.count(index)) {
+        return false;
+    }
+    camera_registry.in_use.insert(index);
+    return true;
+}
+
+void release_camera(int index) {
+    std::lock_guard<std::mutex> lock(camera_registry.mutex);
+    camera_registry.in_use.erase(index);
+}
+
+bool send_camera_list(int socket, const std::vector<int>& cameras) {  // 修改返回类型为bool
     Json::Value cam_list;
     cam_list["type"] = "camera_list";
-    for (size_t i = 0; i < available_cams.size(); ++i) {
-        cam_list["cameras"].append(available_cams[i]);
+    // codec为未声明编码格式的客户端使用的格式，codecs为可选格式（按码率效率排列）
+    cam_list["codec"] = default_encoder().backend->codec;
+    cam_list["codecs"] = Json::Value(Json::arrayValue);
+    for (const auto& choice : encoder_choices) cam_list["codecs"].append(choice.backend->codec);
+    // 同机客户端可据此请求共享内存传输
+    cam_list["host_id"] = host_boot_id();
+    cam_list["transports"].append("rtp");
+    cam_list["transports"].append("shm");
+    cam_list["thumbnails"] = thumbnail_config.enabled;  // 可在选择前发送 get_thumbnails 获取预览
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cam_list["cameras"].append(cameras[i]);
     }
-    std::string json_str = Json::FastWriter().write(cam_list);
-    ssize_t sent_bytes = send(socket, json_str.c_str(), json_str.size(), 0);
-    
-    if (sent_bytes < 0) {
+    // send_json带MSG_NOSIGNAL：握手期间客户端复位连接不会以SIGPIPE终止整个服务端
+    if (!send_json(socket, cam_list)) {
         perror("发送摄像头列表失败");
         return false;
-    } else if (sent_bytes != (ssize_t)json_str.size()) {
-        std::cerr << "警告: 摄像头列表数据未完整发送" << std::endl;
-        return false;
     }
     return true;
 }
 
+// ================== 帧变化检测模块 ==================
+// 静止场景下按块比较当前帧与上一次送编码的帧，变化很小时跳过该帧，
+// 只按保活间隔低速发送，以节省编码CPU和带宽
+struct ChangeDetectConfig {
+    bool enabled = false;
+    int block_size = 16;          // 分块边长（像素）
+    int pixel_threshold = 6;      // 块内平均每字节差异超过该值视为变化块
+    double static_ratio = 0.005;  // 变化块占比低于该值视为静止帧
+    int keepalive_ms = 1000;      // 静止期间的保活帧间隔
+};
+
+ChangeDetectConfig load_change_detect_config() {
+    ChangeDetectConfig cfg;
+    cfg.enabled = env_flag("VS_STATIC_SKIP", false);
+    cfg.block_size = std::max(4, env_int("VS_STATIC_BLOCK", cfg.block_size));
+    cfg.pixel_threshold = env_int("VS_STATIC_PIXEL_DIFF", cfg.pixel_threshold);
+    cfg.static_ratio = env_double("VS_STATIC_RATIO", cfg.static_ratio);
+    cfg.keepalive_ms = env_int("VS_STATIC_KEEPALIVE_MS", cfg.keepalive_ms);
+    return cfg;
+}
+
+struct ChangeResult {
+    double changed_ratio = 1.0;  // 变化块占比
+};
+
+// 计算两段字节的绝对差之和
+static uint64_t row_sad(const uint8_t* a, const uint8_t* b, int len) {
+    uint64_t sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sum = (uint32_t)_mm_cvtsi128_si32(acc) +
+          (uint32_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+#elif defined(__ARM_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+    }
+    sum = (uint64_t)vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+          vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#endif
+    for (; i < len; ++i) {
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+    return sum;
+}
+
+// 分块比较，块内隔行采样以降低开销
+ChangeResult detect_frame_change(const cv::Mat& reference, const cv::Mat& frame,
+                                 const ChangeDetectConfig& cfg) {
+    ChangeResult result;
+    if (reference.empty() || reference.size() != frame.size() ||
+        reference.type() != frame.type()) {
+        return result;
+    }
+
+    const int channels = frame.channels();
+    const int bs = cfg.block_size;
+    int total_blocks = 0, changed_blocks = 0;
+
+    for (int by = 0; by < frame.rows; by += bs) {
+        int bh = std::min(bs, frame.rows - by);
+        for (int bx = 0; bx < frame.cols; bx += bs) {
+            int bw = std::min(bs, frame.cols - bx);
+            uint64_t sad = 0;
+            int sampled = 0;
+            for (int y = by; y < by + bh; y += 2) {
+                sad += row_sad(reference.ptr<uint8_t>(y) + bx * channels,
+                               frame.ptr<uint8_t>(y) + bx * channels,
+                               bw * channels);
+                sampled += bw * channels;
+            }
+            ++total_blocks;
+            if (sampled > 0 && sad > (uint64_t)cfg.pixel_threshold * sampled) {
+                ++changed_blocks;
+            }
+        }
+    }
+
+    result.changed_ratio = total_blocks ? (double)changed_blocks / total_blocks : 0.0;
+    return result;
+}
+
+// 跳帧统计，编码输出字节数由编码器src pad探针累计
+struct StaticSkipStats {
+    uint64_t captured = 0;
+    uint64_t skipped = 0;
+    uint64_t keepalive = 0;
+    std::atomic<uint64_t> encoded_frames{0};
+    std::atomic<uint64_t> encoded_bytes{0};
+};
+
+static GstPadProbeReturn count_encoded_bytes(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    StaticSkipStats* stats = static_cast<StaticSkipStats*>(user_data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buffer) {
+        stats->encoded_frames++;
+        stats->encoded_bytes += gst_buffer_get_size(buffer);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void report_static_skip(const StaticSkipStats& stats, double seconds) {
+    uint64_t frames = stats.encoded_frames.load();
+    uint64_t bytes = stats.encoded_bytes.load();
+    double skip_ratio = stats.captured ? 100.0 * stats.skipped / stats.captured : 0.0;
+    // 按已编码帧的平均大小估算跳过帧本应占用的带宽
+    double saved_kb = frames ? (double)bytes / frames * stats.skipped / 1024.0 : 0.0;
+    std::cout << "[静态跳帧] 跳帧率 " << skip_ratio << "% (" << stats.skipped << "/"
+              << stats.captured << ")，保活帧 " << stats.keepalive
+              << "，发送码率 " << (seconds > 0 ? bytes * 8 / 1000.0 / seconds : 0.0)
+              << " kbps，估计节省 " << saved_kb << " KB" << std::endl;
+}
+
+// ================== 推流工作线程模块 ==================
+struct WorkerConfig {
+    std::vector<int> cores;         // 工作线程依次绑定的CPU核，空表示不绑定
+    int capture_fifo_priority = 0;  // 采集线程SCHED_FIFO优先级，0表示不启用
+};
+WorkerConfig worker_config;
+std::atomic<unsigned> next_worker_slot{0};
+
+WorkerConfig load_worker_config() {
+    WorkerConfig cfg;
+    const char* cores = getenv("VS_WORKER_CORES");  // 例如 "2,3,4"
+    if (cores) {
+        std::stringstream ss(cores);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (!item.empty()) cfg.cores.push_back(atoi(item.c_str()));
+        }
+    }
+    cfg.capture_fifo_priority = env_int("VS_CAPTURE_FIFO", 0);
+    return cfg;
+}
+
+// 按轮转顺序为新工作线程分配CPU核
+int next_worker_core() {
+    if (worker_config.cores.empty()) return -1;
+    unsigned slot = next_worker_slot++;
+    return worker_config.cores[slot % worker_config.cores.size()];
+}
+
+bool pin_current_thread(int core) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void set_capture_realtime(int priority) {
+    struct sched_param param;
+    param.sched_priority = priority;
+    int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rc != 0) {
+        std::cerr << "采集线程SCHED_FIFO设置失败: " << strerror(rc) << std::endl;
+    }
+}
+
+int64_t thread_cpu_ns(clockid_t clock) {
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0) return 0;
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 读取/proc/stat中单个CPU核的忙碌与总jiffies
+bool read_core_jiffies(int core, uint64_t& busy, uint64_t& total) {
+    std::ifstream stat("/proc/stat");
+    std::string line;
+    std::string prefix = "cpu" + std::to_string(core) + " ";
+    while (std::getline(stat, line)) {
+        if (line.compare(0, prefix.size(), prefix) != 0) continue;
+        std::istringstream fields(line.substr(prefix.size()));
+        uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+        fields >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal;
+        busy = user + nice + system + irq + softirq + steal;
+        total = busy + idle + iowait;
+        return true;
+    }
+    return false;
+}
+
+// appsrc推流线程（承载转换、编码与发送）首次处理数据时登记并绑核
+static GstPadProbeReturn register_streaming_thread(GstPad*, GstPadProbeInfo*, gpointer user_data) {
+    StreamWorker* worker = static_cast<StreamWorker*>(user_data);
+    if (worker->core >= 0) pin_current_thread(worker->core);
+    if (pthread_getcpuclockid(pthread_self(), &worker->streaming_clock) == 0) {
+        worker->streaming_clock_valid = true;
+    }
+    return GST_PAD_PROBE_REMOVE;
+}
+
+// 单路摄像头的帧率与CPU统计，由采集线程周期性输出
+struct WorkerMeter {
+    std::chrono::steady_clock::time_point last_time;
+    uint64_t captured = 0;
+    uint64_t pushed = 0;
+    uint64_t last_captured = 0;
+    uint64_t last_pushed = 0;
+    int64_t last_capture_ns = 0;
+    int64_t last_streaming_ns = 0;
+    uint64_t last_core_busy = 0;
+    uint64_t last_core_total = 0;
+};
+
+void report_worker_stats(StreamWorker& worker, WorkerMeter& meter) {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - meter.last_time).count();
+    if (seconds <= 0) return;
+
+    int64_t capture_ns = thread_cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+    int64_t streaming_ns = worker.streaming_clock_valid ? thread_cpu_ns(worker.streaming_clock) : 0;
+    double capture_pct = (capture_ns - meter.last_capture_ns) / 1e7 / seconds;
+    double streaming_pct = (streaming_ns - meter.last_streaming_ns) / 1e7 / seconds;
+
+    std::cout << "[摄像头" << worker.camera_index << " → "
+              << (worker.shm_name.empty() ? "端口" + std::to_string(worker.video_port) : "共享内存") << "] "
+              << (meter.captured - meter.last_captured) / seconds << " fps (编码 "
+              << (meter.pushed - meter.last_pushed) / seconds << " fps)，CPU 采集 "
+              << capture_pct << "% + 推流 " << streaming_pct << "%";
+
+    // 编码器内部线程不便逐一归属，绑核时以所在核心的整体占用作参考
+    uint64_t busy = 0, total = 0;
+    if (worker.core >= 0 && read_core_jiffies(worker.core, busy, total)) {
+        if (meter.last_core_total > 0 && total > meter.last_core_total) {
+            std::cout << "，核心" << worker.core << "占用 "
+                      << 100.0 * (busy - meter.last_core_busy) / (total - meter.last_core_total) << "%";
+        }
+        meter.last_core_busy = busy;
+        meter.last_core_total = total;
+    }
+    std::cout << std::endl;
+
+    meter.last_time = now;
+    meter.last_captured = meter.captured;
+    meter.last_pushed = meter.pushed;
+    meter.last_capture_ns = capture_ns;
+    meter.last_streaming_ns = streaming_ns;
+}
+
+// ================== 批量UDP发送模块 ==================
+// 由appsink取出每帧的RTP包，用sendmmsg批量发送，内核支持时以UDP_SEGMENT(GSO)
+// 合并等长包，减少每包一次的系统调用开销
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+struct UdpSenderConfig {
+    bool batch = true;             // false时回退到udpsink
+    bool gso = true;
+    bool pacing = false;           // 将一帧的突发分散到帧间隔内
+    double pacing_fraction = 0.5;  // 分散发送占用帧间隔的比例
+    int pacing_burst = 16;         // 每次突发的最大包数
+};
+
+UdpSenderConfig load_udp_sender_config() {
+    UdpSenderConfig cfg;
+    cfg.batch = env_flag("VS_UDP_BATCH", cfg.batch);
+    cfg.gso = env_flag("VS_UDP_GSO", cfg.gso);
+    cfg.pacing = env_flag("VS_UDP_PACING", cfg.pacing);
+    cfg.pacing_fraction = env_double("VS_UDP_PACING_FRACTION", cfg.pacing_fraction);
+    cfg.pacing_burst = std::max(1, env_int("VS_UDP_PACING_BURST", cfg.pacing_burst));
+    return cfg;
+}
+
+struct UdpSendStats {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> syscalls{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<int64_t> send_cpu_ns{0};
+};
+
+class UdpBatchSender {
+public:
+    UdpBatchSender(const std::string& host, int port, const UdpSenderConfig& cfg, double fps)
+        : cfg_(cfg), frame_interval_us_(1e6 / (fps > 0 ? fps : 30)) {
+        memset(&dest_, 0, sizeof(dest_));
+        dest_.sin_family = AF_INET;
+        dest_.sin_port = htons(port);
+        inet_pton(AF_INET, host.c_str(), &dest_.sin_addr);
+
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ < 0) {
+            perror("批量发送socket创建失败");
+            return;
+        }
+        int sndbuf = 1 << 20;  // 容纳关键帧突发
+        setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+        // 探测内核是否支持UDP GSO
+        if (cfg_.gso) {
+            int probe = 0;
+            gso_ = setsockopt(fd_, SOL_UDP, UDP_SEGMENT, &probe, sizeof(probe)) == 0;
+        }
+    }
+
+    ~UdpBatchSender() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool valid() const { return fd_ >= 0; }
+    bool gso_enabled() const { return gso_; }
+    const UdpSendStats& stats() const { return stats_; }
+
+    void send_frame(const std::vector<GstBuffer*>& buffers) {
+        if (buffers.empty()) return;
+        int64_t cpu_start = thread_cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+
+        std::vector<GstMapInfo> maps(buffers.size());
+        std::vector<struct iovec> iov(buffers.size());
+        size_t mapped = 0;
+        for (; mapped < buffers.size(); ++mapped) {
+            if (!gst_buffer_map(buffers[mapped], &maps[mapped], GST_MAP_READ)) break;
+            iov[mapped].iov_base = maps[mapped].data;
+            iov[mapped].iov_len = maps[mapped].size;
+        }
+        send_packets(iov.data(), mapped);
+        for (size_t i = 0; i < mapped; ++i) gst_buffer_unmap(buffers[i], &maps[i]);
+
+        stats_.frames++;
+        stats_.packets += mapped;
+        stats_.send_cpu_ns += thread_cpu_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    }
+
+private:
+    // 相邻等长包（末尾可带一个较短包）合并为一条GSO消息，否则每包一条消息
+    void send_packets(struct iovec* iov, size_t count) {
+        const size_t max_segments = cfg_.pacing ? (size_t)cfg_.pacing_burst : 64;
+        const size_t max_gso_bytes = 65000;
+
+        std::vector<struct mmsghdr> msgs;
+        std::vector<size_t> first_packet;
+        std::vector<uint16_t> segment_sizes;
+        for (size_t i = 0; i < count;) {
+            size_t j = i + 1;
+            size_t seg = iov[i].iov_len;
+            if (gso_) {
+                size_t total = seg;
+                while (j < count && iov[j].iov_len == seg && j - i < max_segments &&
+                       total + seg <= max_gso_bytes) {
+                    total += seg;
+                    ++j;
+                }
+                if (j < count && iov[j].iov_len < seg && j - i < max_segments &&
+                    total + iov[j].iov_len <= max_gso_bytes) {
+                    ++j;
+                }
+            }
+            struct mmsghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_hdr.msg_name = &dest_;
+            msg.msg_hdr.msg_namelen = sizeof(dest_);
+            msg.msg_hdr.msg_iov = iov + i;
+            msg.msg_hdr.msg_iovlen = j - i;
+            msgs.push_back(msg);
+            first_packet.push_back(i);
+            segment_sizes.push_back(j - i > 1 ? (uint16_t)seg : 0);
+            i = j;
+        }
+
+        // 控制消息需在msgs扩容完成后再挂接
+        const size_t cmsg_space = CMSG_SPACE(sizeof(uint16_t));
+        std::vector<char> control(msgs.size() * cmsg_space, 0);
+        for (size_t m = 0; m < msgs.size(); ++m) {
+            if (!segment_sizes[m]) continue;
+            msgs[m].msg_hdr.msg_control = &control[m * cmsg_space];
+            msgs[m].msg_hdr.msg_controllen = cmsg_space;
+            struct cmsghdr* cm = CMSG_FIRSTHDR(&msgs[m].msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cm), &segment_sizes[m], sizeof(uint16_t));
+        }
+
+        // 按突发大小分批，开启平滑发送时批次之间均匀留出间隔
+        size_t chunks = 1;
+        if (cfg_.pacing) chunks = (count + cfg_.pacing_burst - 1) / cfg_.pacing_burst;
+        auto gap = std::chrono::microseconds(
+            chunks > 1 ? (int64_t)(frame_interval_us_ * cfg_.pacing_fraction / chunks) : 0);
+
+        size_t sent = 0;
+        while (sent < msgs.size()) {
+            size_t end = sent;
+            size_t packets_in_chunk = 0;
+            while (end < msgs.size() && (!cfg_.pacing || packets_in_chunk == 0 ||
+                   packets_in_chunk + msgs[end].msg_hdr.msg_iovlen <= (size_t)cfg_.pacing_burst)) {
+                packets_in_chunk += msgs[end].msg_hdr.msg_iovlen;
+                ++end;
+            }
+            while (sent < end) {
+                int n = sendmmsg(fd_, &msgs[sent], end - sent, 0);
+                stats_.syscalls++;
+                if (n > 0) {
+                    sent += n;
+                    continue;
+                }
+                if (errno == EINTR) continue;
+                if (gso_ && (errno == EIO || errno == EINVAL)) {
+                    // 网卡或路径不支持GSO，关闭后按单包重发剩余部分
+                    std::cerr << "UDP GSO发送失败，回退为逐包批量发送" << std::endl;
+                    gso_ = false;
+                    size_t first = first_packet[sent];
+                    send_packets(iov + first, count - first);
+                    return;
+                }
+                stats_.errors++;
+                ++sent;  // 跳过出错的消息，避免阻塞后续帧
+            }
+            if (sent < msgs.size() && gap.count() > 0) std::this_thread::sleep_for(gap);
+        }
+    }
+
+    int fd_ = -1;
+    struct sockaddr_in dest_;
+    bool gso_ = false;
+    UdpSenderConfig cfg_;
+    double frame_interval_us_;
+    UdpSendStats stats_;
+};
+
+// 发送线程：从appsink收集一帧的RTP包（以marker位为帧边界）后批量发出
+void run_batch_sender(GstAppSink* sink, UdpBatchSender* sender,
+                      std::atomic<bool>* running, int core, FrameRate frame_rate, int camera_index) {
+    if (core >= 0) pin_current_thread(core);
+    std::vector<GstSample*> samples;
+    std::vector<GstBuffer*> packets;
+    auto flush = [&]() {
+        uint64_t trace_start = trace_now();
+        sender->send_frame(packets);
+        if (trace_start && !packets.empty()) {
+            trace_complete("sendmmsg", trace_start, trace_frame_id(packets[0], frame_rate), camera_index);
+        }
+        for (GstSample* sample : samples) gst_sample_unref(sample);
+        samples.clear();
+        packets.clear();
+    };
+
+    while (*running) {
+        GstSample* sample = gst_app_sink_try_pull_sample(sink, 100 * GST_MSECOND);
+        if (!sample) {
+            if (!packets.empty()) flush();
+            if (gst_app_sink_is_eos(sink)) break;
+            continue;
+        }
+        samples.push_back(sample);
+        GstBufferList* list = gst_sample_get_buffer_list(sample);
+        if (list) {
+            for (guint i = 0; i < gst_buffer_list_length(list); ++i) {
+                packets.push_back(gst_buffer_list_get(list, i));
+            }
+        } else if (GstBuffer* buffer = gst_sample_get_buffer(sample)) {
+            packets.push_back(buffer);
+        }
+
+        guint8 rtp_header[2] = {0, 0};
+        bool marker = !packets.empty() &&
+            gst_buffer_extract(packets.back(), 0, rtp_header, 2) == 2 && (rtp_header[1] & 0x80);
+        if (marker || packets.size() >= 1024) flush();
+    }
+    if (!packets.empty()) flush();
+}
+
+void report_udp_stats(const UdpSendStats& stats, UdpSendStats& last, bool gso) {
+    uint64_t frames = stats.frames - last.frames;
+    if (frames == 0) return;
+    uint64_t packets = stats.packets - last.packets;
+    uint64_t syscalls = stats.syscalls - last.syscalls;
+    int64_t cpu_ns = stats.send_cpu_ns - last.send_cpu_ns;
+    std::cout << "[UDP批量发送] 每帧 " << (double)packets / frames << " 包 / "
+              << (double)syscalls / frames << " 次系统调用，发送CPU "
+              << cpu_ns / 1e3 / frames << "us/帧，GSO " << (gso ? "开启" : "关闭");
+    if (stats.errors > last.errors) std::cout << "，发送错误 " << stats.errors - last.errors;
+    std::cout << std::endl;
+    last.frames = stats.frames.load();
+    last.packets = stats.packets.load();
+    last.syscalls = stats.syscalls.load();
+    last.errors = stats.errors.load();
+    last.send_cpu_ns = stats.send_cpu_ns.load();
+}
+
+// udpsink对每次收到的缓冲或缓冲列表调用一次g_socket_send_messages（sendmmsg），
+// 在其sink pad上按此计数，与批量发送的统计口径一致
+static gboolean count_udpsink_packet(GstBuffer** buffer, guint, gpointer user_data) {
+    UdpSendStats* stats = static_cast<UdpSendStats*>(user_data);
+    stats->packets++;
+    if (trace_rtp_marker(*buffer)) stats->frames++;
+    return TRUE;
+}
+
+static GstPadProbeReturn count_udpsink_sends(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    UdpSendStats* stats = static_cast<UdpSendStats*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info), count_udpsink_packet, stats);
+    } else if (GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info)) {
+        count_udpsink_packet(&buffer, 0, stats);
+    }
+    stats->syscalls++;
+    return GST_PAD_PROBE_OK;
+}
+
+// 本机回环对比：同一编码管道分别以udpsink与批量发送运行，比较发送路径开销
+void run_udp_send_benchmark(int seconds) {
+    int drain = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    int rcvbuf = 4 << 20;
+    setsockopt(drain, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    bind(drain, (struct sockaddr*)&addr, sizeof(addr));
+    getsockname(drain, (struct sockaddr*)&addr, &len);
+    int port = ntohs(addr.sin_port);
+
+    std::atomic<bool> draining{true};
+    std::atomic<uint64_t> received{0};
+    std::thread drainer([&]() {
+        char buf[65536];
+        struct timeval tv = {0, 100000};
+        setsockopt(drain, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (draining) {
+            if (recv(drain, buf, sizeof(buf), 0) > 0) received++;
+        }
+    });
+
+    const std::string source =
+        "videotestsrc is-live=true pattern=smpte horizontal-speed=8 ! "
+        "video/x-raw,format=I420,width=1280,height=720,framerate=30/1 ! " +
+        encoder_pipeline_desc(default_encoder()) + " ! ";
+    const char* modes[] = {"udpsink", "batch"};
+    for (const char* mode : modes) {
+        bool batch = strcmp(mode, "batch") == 0;
+        std::string desc = source + (batch ?
+            "appsink name=rtpsink sync=false buffer-list=true" :
+            "udpsink name=udpsink host=127.0.0.1 port=" + std::to_string(port) + " sync=false");
+        GstElement* pipeline = gst_parse_launch(desc.c_str(), nullptr);
+        if (!pipeline) continue;
+
+        UdpSenderConfig cfg = load_udp_sender_config();
+        UdpBatchSender sender("127.0.0.1", port, cfg, 30);
+        std::atomic<bool> running{true};
+        std::thread sender_thread;
+        UdpSendStats udpsink_stats;
+        GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), batch ? "rtpsink" : "udpsink");
+        if (batch) {
+            sender_thread = std::thread(run_batch_sender, GST_APP_SINK(sink), &sender, &running, -1, FrameRate(), -1);
+        } else if (sink) {
+            GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
+            gst_pad_add_probe(sink_pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                              count_udpsink_sends, &udpsink_stats, nullptr);
+            gst_object_unref(sink_pad);
+        }
+
+        received = 0;
+        struct rusage before, after;
+        getrusage(RUSAGE_SELF, &before);
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        getrusage(RUSAGE_SELF, &after);
+        running = false;
+        if (sender_thread.joinable()) sender_thread.join();
+        if (sink) gst_object_unref(sink);
+        gst_object_unref(pipeline);
+
+        double user_ms = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) * 1e3 +
+                         (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e3;
+        double sys_ms = (after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1e3 +
+                        (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e3;
+        std::cout << "[" << mode << "] " << seconds << "s 收到 " << received.load()
+                  << " 个数据报，进程CPU 用户态 " << user_ms << "ms / 内核态 " << sys_ms << "ms";
+        const UdpSendStats& st = batch ? sender.stats() : udpsink_stats;
+        uint64_t frames = std::max<uint64_t>(1, st.frames);
+        std::cout << "，每帧 " << (double)st.packets / frames << " 包 / "
+                  << (double)st.syscalls / frames << " 次系统调用";
+        if (batch) {
+            std::cout << "，发送CPU " << st.send_cpu_ns / 1e3 / frames << "us/帧，GSO "
+                      << (sender.gso_enabled() ? "开启" : "关闭");
+        }
+        std::cout << std::endl;
+    }
+
+    draining = false;
+    drainer.join();
+    close(drain);
+}
+
 // ================== 视频传输模块 ==================
-void start_video_stream(const std::string& client_ip, int video_port, int camera_index) {
-    available_cams = get_available_cameras(); // 新增：重新检测
-    if (std::find(available_cams.begin(), available_cams.end(), camera_index) == available_cams.end()) {
-        std::cerr << "摄像头" << camera_index << "已不可用" << std::endl;
-        return;
+// 采集线程按帧序号登记采集时刻，打包后在该帧最后一个RTP包上写入，供客户端计算端到端延迟
+class CaptureClock {
+public:
+    explicit CaptureClock(const FrameRate& rate) : rate_(rate) {
+        for (auto& slot : slots_) slot.frame = -1;
+    }
+
+    void record(int64_t frame, guint64 ntp) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Slot& slot = slots_[frame % SLOTS];
+        slot.frame = frame;
+        slot.ntp = ntp;
+    }
+
+    bool lookup(int64_t frame, guint64& ntp) {
+        if (frame < 0) return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Slot& slot = slots_[frame % SLOTS];
+        if (slot.frame != frame) return false;
+        ntp = slot.ntp;
+        return true;
+    }
+
+    // 打包输出的PTS即采集线程按同一帧率打上的PTS，可精确还原帧序号
+    bool lookup_pts(GstClockTime pts, guint64& ntp) { return lookup(frame_index(pts, rate_), ntp); }
+
+private:
+    static const int SLOTS = 64;   // 远大于编码与打包中的在途帧数
+    struct Slot {
+        int64_t frame;
+        guint64 ntp;
+    };
+    std::mutex mutex_;
+    Slot slots_[SLOTS];
+    FrameRate rate_;
+};
+
+static gboolean stamp_capture_time(GstBuffer** buffer, guint, gpointer user_data) {
+    CaptureClock* clock = static_cast<CaptureClock*>(user_data);
+    guint64 ntp = 0;
+    if (!trace_rtp_marker(*buffer) || !clock->lookup_pts(GST_BUFFER_PTS(*buffer), ntp)) {
+        return TRUE;
     }
+    *buffer = gst_buffer_make_writable(*buffer);
+    rtp_write_capture_time(*buffer, ntp);
+    return TRUE;
+}
+
+static GstPadProbeReturn stamp_capture_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList* list = gst_buffer_list_make_writable(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+        GST_PAD_PROBE_INFO_DATA(info) = list;
+        gst_buffer_list_foreach(list, stamp_capture_time, user_data);
+    } else if (GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info)) {
+        stamp_capture_time(&buffer, 0, user_data);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void start_video_stream(ClientSession& session, StreamWorker& worker) {
+    const std::string& client_ip = session.client_ip;
+    const int video_port = worker.video_port;
+    const int camera_index = worker.camera_index;
     GstElement *pipeline = nullptr;
-    gst_init(nullptr, nullptr);
     cv::VideoCapture cap(camera_index);
 
     if (!cap.isOpened()) {
@@ -286,16 +1515,53 @@ void start_video_stream(const std::string& client_ip, int video_port, int camera
     int height = frame.rows;
     double fps = cap.get(cv::CAP_PROP_FPS);
     if (fps <= 0) fps = 30;
+    // PTS、caps与各处由PTS还原帧序号统一使用该分数
+    const FrameRate frame_rate = frame_rate_from_fps(fps);
 
-    std::string pipeline_str = 
-        "appsrc name=source ! "
-        "videoconvert ! "
-        "video/x-raw,format=I420 ! "
-        "x264enc tune=zerolatency speed-preset=ultrafast ! "
-        "rtph264pay config-interval=1 pt=96 ! "
-        "udpsink host=" + client_ip + " port=" + std::to_string(video_port);
-    
-    pipeline = gst_parse_launch(pipeline_str.c_str(), nullptr);
+    // 延迟预算模式：编码前插入有界的丢旧队列，编码后的发送队列只限容不丢帧
+    LatencyBudget budget = load_latency_budget();
+    const double frame_ms = 1000.0 / fps;
+    std::string encode_queue, send_queue;
+    if (budget.enabled) {
+        encode_queue = leaky_queue_desc("q_encode",
+            budget_buffers(budget, SHARE_ENCODE, frame_ms), 0) + " ! ";
+        send_queue = bounded_queue_desc("q_send", 0,
+            budget.mode == LatencyMode::Lowest ? (int)frame_ms : budget_ms(budget, SHARE_SEND)) + " ! ";
+    }
+
+    const EncoderSelection& encoder = encoder_for_codec(session.codec);
+    UdpSenderConfig udp_cfg = load_udp_sender_config();
+    auto pipeline_desc = [&](bool batch) {
+        return "appsrc name=source ! "
+            "videoconvert ! "
+            "video/x-raw,format=I420 ! "
+            + encode_queue + encoder_pipeline_desc(encoder) + " ! " + send_queue +
+            (batch ? std::string("appsink name=rtpsink sync=false buffer-list=true") +
+                 (budget.enabled ? " max-buffers=1" : "") :  // 发送线程跟不上时经q_send反压到q_encode丢弃
+             "udpsink name=udpsink host=" + client_ip + " port=" + std::to_string(video_port));
+    };
+
+    // 批量发送需要发送socket与管道末端的appsink，任一不可用时回退到udpsink
+    std::unique_ptr<UdpBatchSender> udp_sender;
+    if (udp_cfg.batch) {
+        udp_sender.reset(new UdpBatchSender(client_ip, video_port, udp_cfg, fps));
+        if (!udp_sender->valid()) {
+            std::cerr << "[摄像头" << camera_index << "] 批量发送socket不可用，回退到udpsink" << std::endl;
+            udp_sender.reset();
+        }
+    }
+    GstElement *rtpsink = nullptr;
+    if (udp_sender) {
+        pipeline = gst_parse_launch(pipeline_desc(true).c_str(), nullptr);
+        if (pipeline) rtpsink = gst_bin_get_by_name(GST_BIN(pipeline), "rtpsink");
+        if (!rtpsink) {
+            std::cerr << "[摄像头" << camera_index << "] 无法创建批量发送所需的appsink，回退到udpsink" << std::endl;
+            if (pipeline) gst_object_unref(pipeline);
+            pipeline = nullptr;
+            udp_sender.reset();
+        }
+    }
+    if (!pipeline) pipeline = gst_parse_launch(pipeline_desc(false).c_str(), nullptr);
     if (!pipeline) {
         std::cerr << "管道创建失败" << std::endl;
         cap.release();
@@ -305,6 +1571,7 @@ void start_video_stream(const std::string& client_ip, int video_port, int camera
     GstAppSrc *appsrc = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(pipeline), "source"));
     if (!appsrc) {
         std::cerr << "无法获取appsrc元素" << std::endl;
+        if (rtpsink) gst_object_unref(rtpsink);
         gst_object_unref(pipeline);
         cap.release();
         return;
@@ -318,16 +1585,131 @@ void start_video_stream(const std::string& client_ip, int video_port, int camera
         "emit-signals", FALSE,
         nullptr);
 
+    // appsrc不再阻塞采集，满时优先由appsrc自身丢弃最旧帧（GStreamer 1.20+）
+    DropAccounting drops;
+    StageDropCounter *capture_stage = nullptr;
+    bool appsrc_leaky = false;
+    const int capture_buffers = budget.enabled ? budget_buffers(budget, SHARE_CAPTURE, frame_ms) : 0;
+    if (budget.enabled) {
+        g_object_set(appsrc,
+            "block", FALSE,
+            "max-bytes", (guint64)capture_buffers * frame.total() * frame.elemSize(),
+            nullptr);
+        appsrc_leaky = has_property(GST_ELEMENT(appsrc), "leaky-type");
+        if (appsrc_leaky) {
+            g_object_set(appsrc, "max-buffers", (guint64)capture_buffers, "leaky-type", 2, nullptr);
+        }
+        capture_stage = drops.add(pipeline, "source");
+        drops.add(pipeline, "q_encode");
+        std::cout << "延迟预算 " << budget.target_ms << "ms ("
+                  << (budget.mode == LatencyMode::Lowest ? "最低延迟" : "流畅") << ")，appsrc容量 "
+                  << capture_buffers << " 帧" << std::endl;
+    }
+
+    // 记录推流线程并按配置绑核，编码器内部线程随之继承亲和性
+    GstPad *source_pad = gst_element_get_static_pad(GST_ELEMENT(appsrc), "src");
+    gst_pad_add_probe(source_pad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM,
+                      register_streaming_thread, &worker, nullptr);
+    gst_object_unref(source_pad);
+    // q_encode之后编码器运行在队列线程中，同样绑到该核，与校准条件一致
+    GstElement *encode_queue_element = gst_bin_get_by_name(GST_BIN(pipeline), "q_encode");
+    if (encode_queue_element && worker.core >= 0) {
+        GstPad *queue_src = gst_element_get_static_pad(encode_queue_element, "src");
+        gst_pad_add_probe(queue_src, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM,
+                          pin_streaming_thread, GINT_TO_POINTER(worker.core), nullptr);
+        gst_object_unref(queue_src);
+    }
+    if (encode_queue_element) gst_object_unref(encode_queue_element);
+
+    // 帧追踪：以帧序号串起 appsrc → 编码器 → 打包 → 发送 各阶段
+    if (trace_enabled()) {
+        trace_pad(pipeline, "source", "src", {"appsrc_queue", "convert", false, frame_rate, camera_index});
+        trace_pad(pipeline, "encoder", "sink", {"convert", "encode", false, frame_rate, camera_index});
+        trace_pad(pipeline, "encoder", "src", {"encode", "payload", false, frame_rate, camera_index});
+        trace_pad(pipeline, "pay", "src", {"payload", "send", true, frame_rate, camera_index});
+        trace_pad(pipeline, udp_sender ? "rtpsink" : "udpsink", "sink",
+                  {"send", nullptr, true, frame_rate, camera_index});
+    }
+
+    // 端到端延迟：打包输出上写入采集时刻
+    CaptureClock capture_clock(frame_rate);
+    GstElement *payloader = gst_bin_get_by_name(GST_BIN(pipeline), "pay");
+    if (payloader) {
+        GstPad *pay_src = gst_element_get_static_pad(payloader, "src");
+        gst_pad_add_probe(pay_src, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                          stamp_capture_probe, &capture_clock, nullptr);
+        gst_object_unref(pay_src);
+        gst_object_unref(payloader);
+    }
+
+    // 静止场景跳帧：统计编码输出字节以估算节省的带宽
+    ChangeDetectConfig change_cfg = load_change_detect_config();
+    StaticSkipStats skip_stats;
+    if (change_cfg.enabled) {
+        GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+        if (encoder) {
+            GstPad *enc_src = gst_element_get_static_pad(encoder, "src");
+            gst_pad_add_probe(enc_src, GST_PAD_PROBE_TYPE_BUFFER,
+                              count_encoded_bytes, &skip_stats, nullptr);
+            gst_object_unref(enc_src);
+            gst_object_unref(encoder);
+        }
+        std::cout << "静态跳帧已启用 (阈值 " << change_cfg.static_ratio * 100
+                  << "%，保活间隔 " << change_cfg.keepalive_ms << "ms)" << std::endl;
+    }
+
+    // 客户端请求关键帧时向编码器输出端发送上行强制关键帧事件
+    GstPad *encoder_src_pad = nullptr;
+    GstElement *encoder_element = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+    if (encoder_element) {
+        encoder_src_pad = gst_element_get_static_pad(encoder_element, "src");
+        gst_object_unref(encoder_element);
+    }
+    guint keyframes_forced = 0, keyframes_reported = 0;
+
+    // 批量UDP发送线程，与工作线程绑定同一CPU核
+    UdpSendStats udp_last;
+    std::atomic<bool> sender_running{true};
+    std::thread sender_thread;
+    if (udp_sender) {
+        sender_thread = std::thread(run_batch_sender, GST_APP_SINK(rtpsink),
+                                    udp_sender.get(), &sender_running, worker.core,
+                                    frame_rate, camera_index);
+    }
+
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    // 推流线程已创建，此后才提升采集线程优先级，避免被继承
+    if (worker_config.capture_fifo_priority > 0) {
+        set_capture_realtime(worker_config.capture_fifo_priority);
+    }
 
     // 初始化时间跟踪变量
     auto last_frame_time = std::chrono::steady_clock::now();
     int last_res_level = -1;
     uint64_t frame_count = 0;
+    cv::Mat reference_frame;  // 上一次送编码的帧
+    auto last_sent_time = last_frame_time;
+    auto stream_start_time = last_frame_time;
+    auto last_report_time = last_frame_time;
+    WorkerMeter meter;
+    meter.last_time = last_frame_time;
+
+    // 精确帧率控制
+    auto pace_frame = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_frame_time);
+        double target_delay_ms = 1000.0 / fps;
+        int delay = std::max(1, static_cast<int>(target_delay_ms - elapsed.count()));
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        last_frame_time = now;
+    };
+
+    while (!exit_program && session.connected) {
+        const int64_t trace_frame = frame_count;  // 本帧送编码时使用的帧序号
+        uint64_t trace_start = trace_now();
 
-    while (!exit_program && is_connected) {
         // 检查分辨率变化
-        int res_level = current_res_level.load();
+        int res_level = worker.res_level.load();
         if (res_level != last_res_level) {
             int new_width = RES_LEVELS[res_level].first;
             int new_height = RES_LEVELS[res_level].second;
@@ -353,15 +1735,17 @@ void start_video_stream(const std::string& client_ip, int video_port, int camera
                     "format", G_TYPE_STRING, "BGR",
                     "width", G_TYPE_INT, width,
                     "height", G_TYPE_INT, height,
-                    "framerate", GST_TYPE_FRACTION, (int)fps, 1,
+                    "framerate", GST_TYPE_FRACTION, frame_rate.num, frame_rate.den,
                     nullptr);
                 gst_app_src_set_caps(appsrc, new_caps);
                 gst_caps_unref(new_caps);
                 
                 last_res_level = res_level;
             }
+            trace_complete("resolution_change", trace_start, trace_frame, camera_index);
         }
 
+        trace_start = trace_now();
         if (!cap.read(frame)) {
             std::cerr << "摄像头读取失败! 尝试重新初始化..." << std::endl;
             cap.release();
@@ -370,19 +1754,79 @@ void start_video_stream(const std::string& client_ip, int video_port, int camera
                 std::cerr << "摄像头无法重新打开!" << std::endl;
                 break;
             }
-            cap.set(cv::CAP_PROP_FRAME_WIDTH, RES_LEVELS[current_res_level].first);
-            cap.set(cv::CAP_PROP_FRAME_HEIGHT, RES_LEVELS[current_res_level].second);
+            cap.set(cv::CAP_PROP_FRAME_WIDTH, RES_LEVELS[worker.res_level].first);
+            cap.set(cv::CAP_PROP_FRAME_HEIGHT, RES_LEVELS[worker.res_level].second);
             std::this_thread::sleep_for(std::chrono::seconds(1));
             continue;
         }
-    
+        trace_complete("capture_read", trace_start, trace_frame, camera_index);
+        const guint64 capture_ntp = wallclock_ntp();
+
+        meter.captured++;
+        offer_thumbnail(camera_index, frame);
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report_time >= std::chrono::seconds(5)) {
+            report_worker_stats(worker, meter);
+            if (udp_sender) report_udp_stats(udp_sender->stats(), udp_last, udp_sender->gso_enabled());
+            if (!drops.empty()) {
+                std::cout << "[延迟预算] 累计丢弃: " << drops.summary() << std::endl;
+            }
+            if (change_cfg.enabled) {
+                report_static_skip(skip_stats,
+                    std::chrono::duration<double>(now - stream_start_time).count());
+            }
+            if (keyframes_forced != keyframes_reported) {
+                std::cout << "[摄像头" << camera_index << "] 应客户端请求插入关键帧 "
+                          << keyframes_forced - keyframes_reported << " 次" << std::endl;
+                keyframes_reported = keyframes_forced;
+            }
+            last_report_time = now;
+        }
+
+        if (worker.keyframe_requested.exchange(false) && encoder_src_pad) {
+            gst_pad_send_event(encoder_src_pad, gst_video_event_new_upstream_force_key_unit(
+                GST_CLOCK_TIME_NONE, TRUE, ++keyframes_forced));
+            trace_instant("keyframe_request", trace_frame, camera_index);
+        }
+
+        // 静止帧检测：变化低于阈值且未到保活间隔时跳过编码
+        if (change_cfg.enabled) {
+            skip_stats.captured++;
+            ChangeResult change = detect_frame_change(reference_frame, frame, change_cfg);
+            bool is_static = change.changed_ratio < change_cfg.static_ratio;
+            bool keepalive_due = now - last_sent_time >=
+                std::chrono::milliseconds(change_cfg.keepalive_ms);
+
+            if (is_static && !keepalive_due) {
+                trace_instant("static_skip", trace_frame, camera_index);
+                skip_stats.skipped++;
+                frame_count++;  // 保持时间戳连续
+                pace_frame();
+                continue;
+            }
+            if (is_static) skip_stats.keepalive++;
+            frame.copyTo(reference_frame);
+            last_sent_time = now;
+        }
+
         // 动态更新块大小和帧计数器
         size_t current_block_size = frame.total() * frame.elemSize();
         g_object_set(appsrc, 
             "blocksize", (int)current_block_size,
             nullptr);
 
+        // appsrc不支持leaky-type时，积压达到容量即丢弃当前帧
+        if (capture_stage && !appsrc_leaky &&
+            gst_app_src_get_current_level_bytes(appsrc) >= (guint64)capture_buffers * current_block_size) {
+            capture_stage->count_drop();
+            trace_instant("capture_drop", trace_frame, camera_index);
+            frame_count++;  // 保持时间戳连续
+            pace_frame();
+            continue;
+        }
+
         // 创建缓冲区并填充数据
+        trace_start = trace_now();
         GstBuffer *buffer = gst_buffer_new_allocate(nullptr, current_block_size, nullptr);
         GstMapInfo map;
         if (gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
@@ -390,20 +1834,26 @@ void start_video_stream(const std::string& client_ip, int video_port, int camera
             gst_buffer_unmap(buffer, &map);
 
             // 使用已声明的frame_count
-            GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(
-                frame_count, GST_SECOND, fps);
-            GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(
-                1, GST_SECOND, fps);
+            capture_clock.record(frame_count, capture_ntp);
+            GST_BUFFER_PTS(buffer) = frame_pts(frame_count, frame_rate);
+            GST_BUFFER_DURATION(buffer) = frame_pts(frame_count + 1, frame_rate) - GST_BUFFER_PTS(buffer);
             frame_count++;  // 递增帧计数器
         } else {
             gst_buffer_unref(buffer);
             continue;
         }
+        trace_complete("buffer_fill", trace_start, trace_frame, camera_index);
     
         // 推送缓冲区并检查状态
         GstFlowReturn flow_status;
+        if (appsrc_leaky) capture_stage->count_in();
+        trace_start = trace_now();
+        // push-buffer返回前推流线程可能已取走该帧并结束appsrc_queue区间，须先开始
+        trace_begin("appsrc_queue", trace_frame, camera_index, trace_start);
         g_signal_emit_by_name(appsrc, "push-buffer", buffer, &flow_status);
+        trace_complete("push_buffer", trace_start, trace_frame, camera_index);
         gst_buffer_unref(buffer);
+        meter.pushed++;
     
         if (flow_status != GST_FLOW_OK) {
             std::cerr << "视频推送错误: " << gst_flow_get_name(flow_status) 
@@ -416,39 +1866,298 @@ void start_video_stream(const std::string& client_ip, int video_port, int camera
             }
         }
     
-        // 精确帧率控制
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_frame_time);
-        double target_delay_ms = 1000.0 / fps;
-        int delay = std::max(1, static_cast<int>(target_delay_ms - elapsed.count()));
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
-        last_frame_time = now;
+        pace_frame();
     }
 
+    if (change_cfg.enabled) {
+        report_static_skip(skip_stats, std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - stream_start_time).count());
+    }
+    sender_running = false;
+    if (sender_thread.joinable()) sender_thread.join();
+    if (rtpsink) gst_object_unref(rtpsink);
+    if (encoder_src_pad) gst_object_unref(encoder_src_pad);
     gst_element_set_state(pipeline, GST_STATE_NULL);
     gst_object_unref(pipeline);
     cap.release();
 }
 
+// ================== 本地共享内存传输模块 ==================
+// 同机客户端直接读取原始帧：不经过编码器与网络，也不参与拥塞分辨率调整
+struct ShmStreamConfig {
+    int slots = 4;  // 环中槽位数，读端最多可落后 slots-2 帧
+};
+
+ShmStreamConfig load_shm_stream_config() {
+    ShmStreamConfig cfg;
+    cfg.slots = std::max(3, env_int("VS_SHM_SLOTS", cfg.slots));
+    return cfg;
+}
+
+// 控制连接两端地址相同（或为回环地址）即客户端与服务端在同一台主机上
+bool is_local_peer(int sock) {
+    struct sockaddr_in local, peer;
+    socklen_t local_len = sizeof(local), peer_len = sizeof(peer);
+    if (getsockname(sock, (struct sockaddr*)&local, &local_len) != 0 ||
+        getpeername(sock, (struct sockaddr*)&peer, &peer_len) != 0) {
+        return false;
+    }
+    return peer.sin_addr.s_addr == local.sin_addr.s_addr ||
+           (ntohl(peer.sin_addr.s_addr) >> 24) == 127;
+}
+
+std::string make_shm_name(int camera_index) {
+    static std::atomic<int> counter{0};
+    std::ostringstream name;
+    name << "/videoserver-" << getpid() << "-" << counter++ << "-cam" << camera_index;
+    return name.str();
+}
+
+void start_shm_stream(ClientSession& session, StreamWorker& worker) {
+    const int camera_index = worker.camera_index;
+    cv::VideoCapture cap(camera_index);
+    for (int i = 0; i < 3 && !cap.isOpened(); ++i) {  // 重试3次
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        cap.open(camera_index);
+    }
+    cv::Mat frame;
+    if (!cap.isOpened() || !cap.read(frame)) {
+        std::cerr << "[摄像头" << camera_index << "] 初始化失败" << std::endl;
+        return;
+    }
+
+    // 槽位按首帧大小分配，之后尺寸变大的帧直接丢弃
+    ShmStreamConfig cfg = load_shm_stream_config();
+    ShmRingWriter ring;
+    size_t slot_size = frame.total() * frame.elemSize();
+    if (!ring.create(worker.shm_name, cfg.slots, slot_size)) {
+        perror("创建共享内存失败");
+        return;
+    }
+    std::cout << "[摄像头" << camera_index << "] 本地传输 " << worker.shm_name << " "
+              << frame.cols << "x" << frame.rows << " BGR，" << cfg.slots << " 槽位" << std::endl;
+    if (worker_config.capture_fifo_priority > 0) {
+        set_capture_realtime(worker_config.capture_fifo_priority);
+    }
+
+    WorkerMeter meter;
+    meter.last_time = std::chrono::steady_clock::now();
+    uint64_t oversize = 0;
+    while (!exit_program && session.connected) {
+        if (!cap.read(frame)) {
+            std::cerr << "摄像头读取失败! 尝试重新初始化..." << std::endl;
+            cap.release();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            if (!cap.open(camera_index)) break;
+            continue;
+        }
+        uint64_t pts = monotonic_ns();
+        meter.captured++;
+        offer_thumbnail(camera_index, frame);
+        if (!frame.isContinuous()) frame = frame.clone();
+        if (ring.publish(frame.data, frame.cols, frame.rows, (uint32_t)frame.step,
+                         (uint32_t)(frame.total() * frame.elemSize()), pts)) {
+            meter.pushed++;
+        } else {
+            oversize++;
+        }
+
+        if (std::chrono::steady_clock::now() - meter.last_time >= std::chrono::seconds(5)) {
+            report_worker_stats(worker, meter);
+            if (oversize > 0) {
+                std::cerr << "[摄像头" << camera_index << "] 帧超出槽位容量，已丢弃 " << oversize << std::endl;
+            }
+        }
+    }
+    ring.close();
+    cap.release();
+}
+
+// ================== 会话调度模块 ==================
+// 工作线程相互隔离：单个摄像头失败或重开不影响同一会话的其他摄像头
+void run_stream_worker(ClientSession* session, StreamWorker* worker) {
+    if (worker->core >= 0 && !pin_current_thread(worker->core)) {
+        std::cerr << "[摄像头" << worker->camera_index << "] 绑定CPU核"
+                  << worker->core << "失败" << std::endl;
+    }
+    try {
+        if (worker->shm_name.empty()) {
+            start_video_stream(*session, *worker);
+        } else {
+            start_shm_stream(*session, *worker);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[摄像头" << worker->camera_index << "] 推流异常: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "[摄像头" << worker->camera_index << "] 推流发生未知异常" << std::endl;
+    }
+    release_camera(worker->camera_index);
+    std::cout << "[摄像头" << worker->camera_index << "] 推流结束" << std::endl;
+}
+
+// 客户端选择的一路视频流
+struct StreamSelection {
+    int camera_index;
+    int video_port;         // 客户端接收端口
+    bool shm;               // 客户端请求共享内存传输
+};
+
+static bool optional_int(const Json::Value& value) { return value.isNull() || value.isInt(); }
+static bool optional_string(const Json::Value& value) { return value.isNull() || value.isString(); }
+
+// 解析摄像头选择：streams 中每路带客户端分配的接收端口，
+// 旧客户端只发送 camera_indices / camera_index，端口按 VIDEO_PORT+2k 分配。
+// 消息来自网络上的任意客户端，字段类型不符时整条拒绝，jsoncpp不会在会话线程中抛出异常
+bool parse_camera_selection(const Json::Value& selection, std::vector<StreamSelection>& selected) {
+    if (!selection.isObject() || !optional_string(selection["codec"])) return false;
+    if (selection.isMember("streams")) {
+        const Json::Value& streams = selection["streams"];
+        if (!streams.isArray()) return false;
+        for (const auto& entry : streams) {
+            if (!entry.isObject() || !entry["camera_index"].isInt() ||
+                !optional_int(entry["video_port"]) || !optional_string(entry["transport"])) {
+                return false;
+            }
+            int port = entry.get("video_port", 0).asInt();
+            if (port <= 0 || port > 65535) port = VIDEO_PORT + 2 * (int)selected.size();
+            selected.push_back({entry["camera_index"].asInt(), port,
+                                entry.get("transport", "rtp").asString() == "shm"});
+        }
+    } else if (selection.isMember("camera_indices")) {
+        const Json::Value& indices = selection["camera_indices"];
+        if (!indices.isArray()) return false;
+        for (const auto& index : indices) {
+            if (!index.isInt()) return false;
+            selected.push_back({index.asInt(), VIDEO_PORT + 2 * (int)selected.size(), false});
+        }
+    } else {
+        if (!selection["camera_index"].isInt() || !optional_int(selection["video_port"])) return false;
+        selected.push_back({selection["camera_index"].asInt(),
+                            selection.get("video_port", VIDEO_PORT).asInt(), false});
+    }
+    return true;
+}
+
+// 握手：发送摄像头列表，应答缩略图请求，直到收到合法的摄像头选择
+bool negotiate_session(ClientSession* session, std::vector<StreamSelection>& selected) {
+    std::vector<int> cameras = get_available_cameras();
+    if (cameras.empty()) {
+        std::cerr << "错误: 当前无可用摄像头!" << std::endl;
+        return false;
+    }
+
+    // 发送摄像头列表
+    if (!send_camera_list(session->socket, cameras)) return false;
+
+    // 选择之前客户端可发送 get_thumbnails 获取预览，可重复请求
+    Json::Value selection;
+    while (true) {
+        if (!recv_json_line(session->socket, selection)) return false;
+        if (!selection.isObject() || selection.get("type", "") != "get_thumbnails") break;
+        encode_pending_thumbnails();  // 刚探测到的帧可能尚未压缩
+        if (!send_json(session->socket, thumbnails_json(cameras))) return false;
+    }
+    if (!parse_camera_selection(selection, selected)) {
+        std::cerr << "客户端 " << session->client_ip << " 的摄像头选择格式无效" << std::endl;
+        return false;
+    }
+    session->codec = encoder_for_codec(selection.get("codec", "").asString()).backend->codec;
+    return true;
+}
+
+// 为每路选择占用摄像头并创建工作线程描述；请求本地传输时先回复各路实际使用的传输方式
+bool prepare_stream_workers(ClientSession* session, const std::vector<StreamSelection>& selected) {
+    bool local_peer = is_local_peer(session->socket);
+    bool shm_requested = false;
+    Json::Value setup;
+    setup["type"] = "stream_setup";
+    for (const auto& sel : selected) {
+        if (!acquire_camera(sel.camera_index)) {
+            std::cerr << "摄像头" << sel.camera_index << "已不可用或正被占用" << std::endl;
+            continue;
+        }
+        std::unique_ptr<StreamWorker> worker(new StreamWorker);
+        worker->camera_index = sel.camera_index;
+        worker->video_port = sel.video_port;
+        worker->core = next_worker_core();
+        shm_requested = shm_requested || sel.shm;
+        if (sel.shm && local_peer) worker->shm_name = make_shm_name(sel.camera_index);
+
+        Json::Value entry;
+        entry["camera_index"] = sel.camera_index;
+        entry["transport"] = worker->shm_name.empty() ? "rtp" : "shm";
+        if (!worker->shm_name.empty()) entry["shm_name"] = worker->shm_name;
+        setup["streams"].append(entry);
+        session->workers.push_back(std::move(worker));
+    }
+    return !shm_requested || send_json(session->socket, setup);
+}
+
+void run_client_session(ClientSession* session) {
+    // 握手阶段处理的是不可信的客户端数据，异常不能逃出会话线程，
+    // 否则std::terminate会连带结束其他会话
+    bool ready = false;
+    try {
+        std::vector<StreamSelection> selected;
+        ready = negotiate_session(session, selected) && prepare_stream_workers(session, selected);
+    } catch (const std::exception& e) {
+        std::cerr << "客户端 " << session->client_ip << " 握手异常: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "客户端 " << session->client_ip << " 握手发生未知异常" << std::endl;
+    }
+    if (!ready) {
+        for (auto& worker : session->workers) release_camera(worker->camera_index);
+        close(session->socket);
+        session->finished = true;
+        return; // 握手失败，跳过此客户端
+    }
+
+    // 开始心跳与各路推流
+    std::thread heartbeat(heartbeat_listener, session);
+    for (auto& worker : session->workers) {
+        worker->thread = std::thread(run_stream_worker, session, worker.get());
+    }
+
+    heartbeat.join();
+    for (auto& worker : session->workers) worker->thread.join();
+    session->finished = true;
+}
+
 // ================== 主控制逻辑 ==================
-int main() {
-    // 注册信号处理
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+int main(int argc, char* argv[]) {
+    // 注册信号处理（不设SA_RESTART，阻塞的accept被中断后检查退出标志）
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
 
-    // 将listen_sock改为全局变量
-    
+    // 基准测试模式：./server --bench-udp [秒数]
+    if (argc > 1 && strcmp(argv[1], "--bench-udp") == 0) {
+        gst_init(&argc, &argv);
+        worker_config = load_worker_config();
+        calibrate_encoder(worker_config.cores.empty() ? -1 : worker_config.cores[0]);
+        run_udp_send_benchmark(argc > 2 ? std::max(1, atoi(argv[2])) : 10);
+        return 0;
+    }
 
-    available_cams = get_available_cameras();
-    if (available_cams.empty()) {
+    thumbnail_config = load_thumbnail_config();
+    if (get_available_cameras().empty()) {
         std::cerr << "错误: 未找到可用摄像头!" << std::endl;
         return 1;
     }
 
+    gst_init(nullptr, nullptr);
+    worker_config = load_worker_config();
+    calibrate_encoder(worker_config.cores.empty() ? -1 : worker_config.cores[0]);
+    FrameTracer::instance().configure("server");
+
     std::thread broadcast_thread(broadcast_server_presence);
+    std::thread thumbnail_thread(thumbnail_worker);
 
     // 创建监听socket（保持长连接）
-    int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_sock < 0) {
         perror("socket creation failed");
         return 1;
@@ -478,6 +2187,7 @@ int main() {
         return 1;
     }
 
+    std::list<std::shared_ptr<ClientSession>> sessions;
     try {
         while (!exit_program) {
             std::cout << "等待客户端连接..." << std::endl;
@@ -490,39 +2200,24 @@ int main() {
                 continue;
             }
 
-            available_cams = get_available_cameras();  
-            if (available_cams.empty()) {
-                std::cerr << "错误: 当前无可用摄像头!" << std::endl;
-                close(client_sock);
-                continue;
+            // 回收已结束的会话
+            for (auto it = sessions.begin(); it != sessions.end();) {
+                if ((*it)->finished) {
+                    (*it)->thread.join();
+                    it = sessions.erase(it);
+                } else {
+                    ++it;
+                }
             }
 
-            is_connected = true;
-            std::string client_ip = inet_ntoa(client_addr.sin_addr);
-            std::cout << "客户端连接来自: " << client_ip << std::endl;
+            std::shared_ptr<ClientSession> session(new ClientSession);
+            session->socket = client_sock;
+            session->client_ip = inet_ntoa(client_addr.sin_addr);
+            std::cout << "客户端连接来自: " << session->client_ip << std::endl;
 
-            // 发送摄像头列表
-            if (!send_camera_list(client_sock)) {
-                close(client_sock);
-                continue; // 发送失败，跳过此客户端
-            }
-
-            // 接收摄像头选择
-            char buffer[256];
-            int n = recv(client_sock, buffer, sizeof(buffer), 0);
-            if (n > 0) {
-                Json::Value selection;
-                if (Json::Reader().parse(buffer, buffer + n, selection)) {
-                    int cam_index = selection["camera_index"].asInt();
-                    
-                    // 设置心跳socket并启动线程
-                    heartbeat_socket = client_sock;
-                    std::thread(heartbeat_listener).detach();
-                    start_video_stream(client_ip, 5000, cam_index);
-                }
-            } else {
-                close(client_sock);
-            }
+            // 握手与推流在会话线程中进行，主线程继续接受新连接
+            session->thread = std::thread(run_client_session, session.get());
+            sessions.push_back(session);
         }
     }
     catch (const std::exception& e) {
@@ -532,13 +2227,21 @@ int main() {
     }
 
     // 确保最终清理
+    if (exit_program) std::cout << "\n收到终止信号，清理资源..." << std::endl;
+    exit_program = true;
     if (listen_sock != -1) {
-        shutdown(listen_sock, SHUT_RDWR);
-        close(listen_sock);
+        int sock = listen_sock;
+        listen_sock = -1;
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
     }
 
-    // close(listen_sock);
-    exit_program = true;
+    for (auto& session : sessions) {
+        if (session->thread.joinable()) session->thread.join();
+    }
     broadcast_thread.join();
+    camera_registry.thumbnail_cv.notify_all();
+    thumbnail_thread.join();
+    FrameTracer::instance().write();
     return 0;
 }
\ No newline at end of file
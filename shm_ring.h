@@ -0,0 +1,288 @@
+/*
+filename: shm_ring.h
+author: Linductor
+data: 2026/10/19
+*/
+#ifndef VIDEOSERVER_SHM_RING_H
+#define VIDEOSERVER_SHM_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <new>
+#include <string>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// ================== 共享内存帧环模块 ==================
+// 同机客户端的本地传输：服务端把采集到的原始BGR帧写入固定数量的槽位，
+// 客户端映射同一块共享内存直接读取，省去编码、UDP回环与解码。
+// 写端从不等待读端；读端落后超过环长时跳到最新帧，并按帧序号统计丢帧。
+
+const uint32_t SHM_RING_MAGIC = 0x31525356;   // "VSR1"
+const uint32_t SHM_RING_VERSION = 1;
+const size_t SHM_RING_ALIGN = 64;             // 槽位按缓存行对齐
+
+struct ShmRingHeader {
+    std::atomic<uint32_t> magic;              // 初始化完成后最后写入
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t reserved;
+    uint64_t slot_size;                       // 每个槽位数据区字节数
+    uint64_t slot_stride;                     // 相邻槽位间距（含槽位头）
+    std::atomic<uint64_t> write_seq;          // 最新已完成帧序号，从1开始
+    std::atomic<uint32_t> notify;             // futex唤醒计数
+    std::atomic<uint32_t> waiters;            // 正在等待新帧的读端数
+    std::atomic<uint32_t> closed;             // 写端已结束
+};
+
+struct ShmSlotHeader {
+    std::atomic<uint64_t> state;              // 2n-1：正在写第n帧；2n：第n帧已完成
+    uint64_t pts_ns;                          // 采集时刻（CLOCK_MONOTONIC，同机进程可直接比较）
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;                          // 每行字节数
+    uint32_t size;
+};
+
+// 读端拿到的一帧，data直接指向共享内存
+struct ShmFrame {
+    uint64_t seq = 0;
+    uint64_t pts_ns = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;
+    uint32_t size = 0;
+    const uint8_t* data = nullptr;
+};
+
+inline size_t shm_align(size_t size) {
+    return (size + SHM_RING_ALIGN - 1) / SHM_RING_ALIGN * SHM_RING_ALIGN;
+}
+
+inline uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 本次开机的唯一标识，两端一致说明运行在同一台主机上
+inline std::string host_boot_id() {
+    std::ifstream in("/proc/sys/kernel/random/boot_id");
+    std::string id;
+    std::getline(in, id);
+    return id;
+}
+
+// 共享映射上的futex（不能使用PRIVATE标志）
+inline void shm_futex_wake(std::atomic<uint32_t>* word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline void shm_futex_wait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms) {
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+class ShmRingBase {
+protected:
+    ShmSlotHeader* slot_at(uint64_t seq) const {
+        uint8_t* base = static_cast<uint8_t*>(base_) + shm_align(sizeof(ShmRingHeader));
+        return reinterpret_cast<ShmSlotHeader*>(
+            base + ((seq - 1) % header_->slot_count) * header_->slot_stride);
+    }
+
+    static uint8_t* slot_data(ShmSlotHeader* slot) {
+        return reinterpret_cast<uint8_t*>(slot) + shm_align(sizeof(ShmSlotHeader));
+    }
+
+    void unmap() {
+        if (base_) munmap(base_, length_);
+        base_ = nullptr;
+        header_ = nullptr;
+    }
+
+    void* base_ = nullptr;
+    size_t length_ = 0;
+    ShmRingHeader* header_ = nullptr;
+};
+
+// 服务端：每路本地传输的摄像头一个写端
+class ShmRingWriter : public ShmRingBase {
+public:
+    ~ShmRingWriter() { close(); }
+
+    bool create(const std::string& name, uint32_t slot_count, uint64_t slot_size) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);  // 仅同一用户可读
+        if (fd < 0) return false;
+        uint64_t stride = shm_align(sizeof(ShmSlotHeader)) + shm_align(slot_size);
+        length_ = shm_align(sizeof(ShmRingHeader)) + stride * slot_count;
+        if (ftruncate(fd, length_) != 0) {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        base_ = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base_ == MAP_FAILED) {
+            base_ = nullptr;
+            shm_unlink(name.c_str());
+            return false;
+        }
+        name_ = name;
+
+        // ftruncate后内容全为0，槽位状态0即“空”
+        header_ = new (base_) ShmRingHeader();
+        header_->version = SHM_RING_VERSION;
+        header_->slot_count = slot_count;
+        header_->slot_size = slot_size;
+        header_->slot_stride = stride;
+        header_->write_seq.store(0, std::memory_order_relaxed);
+        header_->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+        return true;
+    }
+
+    // 写入一帧，超出槽位容量时返回false
+    bool publish(const uint8_t* data, uint32_t width, uint32_t height, uint32_t stride,
+                 uint32_t size, uint64_t pts_ns) {
+        if (!header_ || size > header_->slot_size) return false;
+        uint64_t n = seq_ + 1;
+        ShmSlotHeader* slot = slot_at(n);
+        slot->state.store(2 * n - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(slot_data(slot), data, size);
+        slot->pts_ns = pts_ns;
+        slot->width = width;
+        slot->height = height;
+        slot->stride = stride;
+        slot->size = size;
+        slot->state.store(2 * n, std::memory_order_release);
+        header_->write_seq.store(n, std::memory_order_release);
+        seq_ = n;
+
+        header_->notify.fetch_add(1, std::memory_order_release);
+        if (header_->waiters.load(std::memory_order_acquire) > 0) shm_futex_wake(&header_->notify);
+        return true;
+    }
+
+    // 标记结束并删除名字，已映射的读端仍可读完剩余帧
+    void close() {
+        if (!header_) return;
+        header_->closed.store(1, std::memory_order_release);
+        header_->notify.fetch_add(1, std::memory_order_release);
+        shm_futex_wake(&header_->notify);
+        unmap();
+        shm_unlink(name_.c_str());
+    }
+
+    uint64_t frames() const { return seq_; }
+
+private:
+    std::string name_;
+    uint64_t seq_ = 0;
+};
+
+// 客户端：零拷贝读取，使用完一帧后调用release确认读取期间未被覆盖
+class ShmRingReader : public ShmRingBase {
+public:
+    ~ShmRingReader() { unmap(); }
+
+    bool open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);  // 读端需要写waiters计数
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+            ::close(fd);
+            return false;
+        }
+        length_ = st.st_size;
+        base_ = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base_ == MAP_FAILED) {
+            base_ = nullptr;
+            return false;
+        }
+        header_ = static_cast<ShmRingHeader*>(base_);
+        if (header_->magic.load(std::memory_order_acquire) != SHM_RING_MAGIC ||
+            header_->version != SHM_RING_VERSION || header_->slot_count == 0 ||
+            shm_align(sizeof(ShmRingHeader)) + header_->slot_stride * header_->slot_count > length_) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    // 等待下一帧，timeout_ms内没有新帧返回false；落后超过环长时跳到最新帧
+    bool acquire(ShmFrame& frame, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            uint32_t ticket = header_->notify.load(std::memory_order_acquire);
+            uint64_t latest = header_->write_seq.load(std::memory_order_acquire);
+            if (latest <= last_seq_) {
+                if (writer_closed()) return false;
+                int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+                if (remaining <= 0) return false;
+                header_->waiters.fetch_add(1, std::memory_order_acq_rel);
+                shm_futex_wait(&header_->notify, ticket, remaining);
+                header_->waiters.fetch_sub(1, std::memory_order_acq_rel);
+                continue;
+            }
+
+            // 写端下一帧会覆盖 latest+1-slot_count，更早的槽位已不可靠
+            uint64_t next = last_seq_ + 1;
+            uint64_t oldest = latest + 2 > header_->slot_count ? latest + 2 - header_->slot_count : 1;
+            if (last_seq_ == 0 || next < oldest) next = latest;
+            if (last_seq_ > 0) dropped_ += next - last_seq_ - 1;
+            last_seq_ = next;
+
+            ShmSlotHeader* slot = slot_at(next);
+            if (slot->state.load(std::memory_order_acquire) != 2 * next) {
+                torn_++;  // 读取前已被覆盖
+                continue;
+            }
+            frame.seq = next;
+            frame.pts_ns = slot->pts_ns;
+            frame.width = slot->width;
+            frame.height = slot->height;
+            frame.stride = slot->stride;
+            frame.size = (uint32_t)std::min<uint64_t>(slot->size, header_->slot_size);
+            frame.data = slot_data(slot);
+            return true;
+        }
+    }
+
+    // 帧数据使用完毕，返回false表示读取期间被写端覆盖，数据应丢弃
+    bool release(const ShmFrame& frame) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot_at(frame.seq)->state.load(std::memory_order_relaxed) == 2 * frame.seq) return true;
+        torn_++;
+        return false;
+    }
+
+    bool writer_closed() const {
+        return header_->closed.load(std::memory_order_acquire) != 0 &&
+               header_->write_seq.load(std::memory_order_acquire) <= last_seq_;
+    }
+
+    uint64_t dropped() const { return dropped_; }   // 因落后被跳过的帧
+    uint64_t torn() const { return torn_; }         // 读取期间被覆盖而丢弃的帧
+
+private:
+    uint64_t last_seq_ = 0;
+    uint64_t dropped_ = 0;
+    uint64_t torn_ = 0;
+};
+
+#endif